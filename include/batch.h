@@ -0,0 +1,36 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+  BATCH_GOTO = 0,
+  BATCH_INSERT,
+  BATCH_DELETE,
+  BATCH_REPLACE,
+} batch_op_kind;
+
+// One step of an edit script. Text arguments are already unescaped.
+typedef struct {
+  batch_op_kind kind;
+  size_t line;  // goto: 1-based line, 0 for the end of the buffer
+  size_t col;   // goto: 1-based column
+  size_t count; // delete: bytes after the caret
+  char *text;   // insert text / replace pattern
+  size_t text_len;
+  char *with; // replace: replacement
+  size_t with_len;
+} batch_op_t;
+
+typedef struct {
+  batch_op_t *ops;
+  size_t count;
+} batch_script_t;
+
+bool batch_script_load(batch_script_t *script, const char *path);
+void batch_script_free(batch_script_t *script);
+
+int batch_run(int argc, char *argv[]);
+
+#endif // !BATCH_H
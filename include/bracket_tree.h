@@ -0,0 +1,42 @@
+#ifndef BRACKET_TREE_H
+#define BRACKET_TREE_H
+
+#include "editor.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BRACKET_BLOCK_SIZE 4096 // target block size, blocks split at twice this
+#define BRACKET_KINDS 3         // () [] {}
+
+// Bracket balance of one block or subtree, per bracket kind. Openers count
+// +1 and closers -1; `min_prefix` is the lowest running sum over all
+// prefixes (the empty one included), so the highest suffix sum is
+// `net - min_prefix`. Together they tell whether a match can be inside
+// without looking at the bytes. An all-zero summary is the empty block.
+typedef struct {
+  size_t len;
+  int64_t net[BRACKET_KINDS];
+  int64_t min_prefix[BRACKET_KINDS];
+} bracket_summary_t;
+
+// Segment tree over variable-length blocks of the buffer. Leaves sit at
+// [leaf_cap, 2 * leaf_cap); node i covers children 2i and 2i + 1. Blocks are
+// spread out with empty leaves between them, so a block that splits only
+// shifts its neighbours.
+typedef struct {
+  editor_t *editor;
+  bracket_summary_t *nodes; // NULL until a build succeeds
+  size_t leaf_cap;
+  size_t block_count; // non-empty leaves
+  char *scratch; // holds one block while it is rescanned
+} bracket_tree_t;
+
+bracket_tree_t *bracket_tree_create(editor_t *editor);
+void bracket_tree_destroy(bracket_tree_t *t);
+
+bool bracket_tree_match(bracket_tree_t *t, size_t pos, size_t *match);
+bool bracket_tree_match_near(bracket_tree_t *t, size_t pos, size_t *bracket,
+                             size_t *match);
+
+#endif // !BRACKET_TREE_H
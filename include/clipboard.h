@@ -0,0 +1,34 @@
+#ifndef CLIPBOARD_H
+#define CLIPBOARD_H
+
+#include "editor.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Copies up to this size go to the system clipboard right away
+#define CLIPBOARD_EAGER_LIMIT (1 << 20)
+
+// Copy/paste between the editor and the system clipboard. A large copy is
+// kept as a range of the buffer and only turned into a string when it has to
+// leave the editor: the window loses focus or the editor exits. An edit about
+// to change the copied text first moves its bytes into the clipboard.
+typedef struct {
+  editor_t *editor;
+
+  bool pending; // [pos, pos + len) is copied but not yet published
+  size_t pos;
+  size_t len;
+  char *owned; // the copied bytes once taken out of the buffer, else NULL
+} clipboard_t;
+
+clipboard_t *clipboard_create(editor_t *editor);
+void clipboard_destroy(clipboard_t *c);
+
+void clipboard_copy(clipboard_t *c, size_t pos, size_t len);
+bool clipboard_copy_selection(clipboard_t *c);
+bool clipboard_cut_selection(clipboard_t *c);
+bool clipboard_paste(clipboard_t *c);
+void clipboard_publish(clipboard_t *c);
+void clipboard_forget(clipboard_t *c);
+
+#endif // !CLIPBOARD_H
@@ -0,0 +1,47 @@
+#ifndef COLUMN_INDEX_H
+#define COLUMN_INDEX_H
+
+#include "gap_buffer.h"
+#include "line_index.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#define COLUMN_INDEX_SLOTS 1024 // cached lines, direct mapped by line number
+#define COLUMN_CHECKPOINT 64    // columns between checkpoints
+
+// A known (byte, column) pair inside a line, always at a character start
+typedef struct {
+  size_t byte;
+  size_t col;
+} column_checkpoint_t;
+
+// Byte <-> display column map of one line, built on first use. ASCII-only
+// lines need no checkpoints since bytes and columns coincide.
+typedef struct {
+  bool valid;
+  bool ascii;
+  size_t line;
+  size_t bytes;
+  size_t columns;
+  column_checkpoint_t *cps;
+  size_t count;
+  size_t capacity;
+} column_line_t;
+
+typedef struct {
+  const gap_buffer_t *buffer;
+  const line_index_t *lines;
+  column_line_t slots[COLUMN_INDEX_SLOTS];
+} column_index_t;
+
+void column_index_init(column_index_t *ci, const gap_buffer_t *g,
+                       const line_index_t *li);
+void column_index_free(column_index_t *ci);
+void column_index_update(column_index_t *ci, size_t pos, size_t removed,
+                         size_t inserted, size_t first_line, long line_delta);
+
+size_t column_index_col_of(column_index_t *ci, size_t line, size_t byte);
+size_t column_index_byte_of(column_index_t *ci, size_t line, size_t col);
+size_t column_index_columns(column_index_t *ci, size_t line);
+
+#endif // !COLUMN_INDEX_H
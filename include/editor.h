@@ -2,6 +2,9 @@
 #define EDITOR_H
 
 #include "gap_buffer.h"
+#include "SDL_mutex.h"
+#include "column_index.h"
+#include "line_index.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -10,13 +13,54 @@ typedef enum {
   RUNNING,
 } editor_state;
 
+// Describes one edit after it has been applied to the buffer
+typedef struct {
+  size_t pos;        // byte offset of the edit
+  size_t removed;    // bytes removed at pos
+  size_t inserted;   // bytes inserted at pos
+  size_t first_line; // line containing pos
+  long line_delta;   // change in the number of lines
+} editor_change_t;
+
+typedef void (*editor_listener_fn)(void *ctx, const editor_change_t *change);
+
+#define EDITOR_MAX_LISTENERS 8
+
 typedef struct {
   editor_state state;
 
   gap_buffer_t *buffer;
+  line_index_t lines;
+  column_index_t columns; // byte <-> display column map of cached lines
+
+  char *path; // file backing the buffer, NULL for a scratch buffer
+  bool dirty;   // edited since the last load from disk
+  bool syncing; // edits replay changes made on disk and leave `dirty` alone
+
+  // Held while the buffer is mutated; background readers take it too
+  SDL_mutex *lock;
+
+  struct {
+    editor_listener_fn fn;
+    void *ctx;
+  } listeners[EDITOR_MAX_LISTENERS];
+  int listener_count;
+
+  // Called before an edit touches the buffer; line_delta is not known yet
+  struct {
+    editor_listener_fn fn;
+    void *ctx;
+  } before_listeners[EDITOR_MAX_LISTENERS];
+  int before_listener_count;
+
+  // Selection between anchor and head. While one is active the head is the
+  // caret, and the gap is only moved there once something needs it.
+  bool selecting;
+  size_t anchor;
+  size_t head;
 
   int cursor_line;
-  int cursor_col;
+  int cursor_col; // display column, not byte offset
 
   int scroll_y; // vertical scroll offset (line index)
   int scroll_x; // horizontal scroll offset (column index)
@@ -28,13 +72,46 @@ typedef struct {
 editor_t *editor_create(size_t inital_capacity);
 void editor_destory(editor_t *editor);
 
+void editor_lock(editor_t *editor);
+void editor_unlock(editor_t *editor);
+bool editor_add_listener(editor_t *editor, editor_listener_fn fn, void *ctx);
+bool editor_add_before_listener(editor_t *editor, editor_listener_fn fn,
+                                void *ctx);
+void editor_remove_listener(editor_t *editor, editor_listener_fn fn,
+                            void *ctx);
+
 void editor_insert_char(editor_t *editor, const char c);
+bool editor_insert_text(editor_t *editor, const char *text, size_t n);
+bool editor_insert_range(editor_t *editor, size_t src, size_t n);
+void editor_delete_range(editor_t *editor, size_t pos, size_t n);
 void editor_cursor_recompute_ticks(editor_t *editor);
 void editor_backspace(editor_t *editor);
 void editor_move_left(editor_t *editor);
 void editor_move_right(editor_t *editor);
 void editor_move_up(editor_t *editor);
 void editor_move_down(editor_t *editor);
+void editor_move_to(editor_t *editor, size_t pos);
 int editor_get_line_length(editor_t *editor, int line_number);
+int editor_count_lines(editor_t *e);
+char *editor_get_line(editor_t *editor, int line_number);
+char *editor_get_line_columns(editor_t *editor, int line_number, int first_col,
+                              int max_cols);
+size_t editor_col_to_byte(editor_t *editor, int line_number, int col);
+int editor_byte_to_col(editor_t *editor, int line_number, size_t byte);
+void editor_sync_cursor(editor_t *editor);
+
+size_t editor_caret(const editor_t *editor);
+void editor_select_all(editor_t *editor);
+void editor_select_with(editor_t *editor, void (*move)(editor_t *));
+void editor_clear_selection(editor_t *editor);
+bool editor_get_selection(const editor_t *editor, size_t *start, size_t *end);
+bool editor_delete_selection(editor_t *editor);
+
+bool editor_open_file(editor_t *editor, const char *path);
+bool editor_save(editor_t *editor, const char *path);
+char *editor_resolve_path(const char *path);
+bool editor_append(editor_t *editor, const char *data, size_t n);
+bool editor_replace_range(editor_t *editor, size_t pos, size_t old_len,
+                          const char *data, size_t new_len);
 
 #endif // !EDITOR_H
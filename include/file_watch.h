@@ -0,0 +1,34 @@
+#ifndef FILE_WATCH_H
+#define FILE_WATCH_H
+
+#include "editor.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FILE_WATCH_BLOCK_SIZE 65536
+
+// Follows the file behind an editor buffer for changes made by other
+// programs. Block hashes describe the file as it was at the last sync so a
+// rewrite only touches the blocks that actually differ.
+typedef struct {
+  int fd; // inotify instance, -1 when watching is unavailable
+  int wd; // watch on `path`, -1 while the file is missing
+  char *path;
+
+  size_t known_size;      // file size the buffer was last synced to
+  int64_t known_mtime;    // its modification time in ns, -1 if unknown
+  uint64_t *block_hashes; // FNV-1a hash of each FILE_WATCH_BLOCK_SIZE block
+  size_t block_count;
+  size_t block_capacity;
+  bool stale;   // hashes do not describe the buffer; the next sync reloads it
+  bool pending; // the last sync failed part way and is retried on next poll
+} file_watch_t;
+
+file_watch_t *file_watch_create(editor_t *editor);
+void file_watch_destroy(file_watch_t *w);
+
+void file_watch_resync(file_watch_t *w, editor_t *editor);
+bool file_watch_poll(file_watch_t *w, editor_t *editor);
+
+#endif // !FILE_WATCH_H
@@ -1,6 +1,7 @@
 #ifndef GAP_BUFFER_H
 #define GAP_BUFFER_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 typedef struct {
@@ -13,15 +14,25 @@ typedef struct {
 gap_buffer_t *gap_create(size_t initial_capacity);
 void gap_destroy(gap_buffer_t *g);
 
-void gap_expand(gap_buffer_t *g);
+bool gap_expand(gap_buffer_t *g);
+bool gap_reserve(gap_buffer_t *g, size_t n);
 char gap_peek_before(gap_buffer_t *g);
 char gap_peek_after(gap_buffer_t *g);
-void gap_insert_char(gap_buffer_t *g, const char c);
+bool gap_insert_char(gap_buffer_t *g, const char c);
+bool gap_insert_bytes(gap_buffer_t *g, const char *data, size_t n);
+bool gap_append(gap_buffer_t *g, const char *data, size_t n);
+bool gap_replace_range(gap_buffer_t *g, size_t pos, size_t old_len,
+                       const char *data, size_t new_len);
+bool gap_insert_range(gap_buffer_t *g, size_t src, size_t n);
+void gap_delete_range(gap_buffer_t *g, size_t pos, size_t n);
 void gap_delete_char(gap_buffer_t *g);
 void gap_move_left(gap_buffer_t *g);
 void gap_move_right(gap_buffer_t *g);
+void gap_move_to(gap_buffer_t *g, size_t pos);
 void gap_print(const gap_buffer_t *g);
 void gap_to_string(const gap_buffer_t *g, char *out);
 int gap_buffer_length(const gap_buffer_t *g);
+char gap_char_at(const gap_buffer_t *g, size_t pos);
+size_t gap_copy_range(const gap_buffer_t *g, size_t pos, size_t n, char *out);
 
 #endif // !GAP_BUFFER_H
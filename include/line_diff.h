@@ -0,0 +1,49 @@
+#ifndef LINE_DIFF_H
+#define LINE_DIFF_H
+
+#include "editor.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Gutter marks of a live line, relative to the saved file
+#define LINE_DIFF_ADDED 0x1
+#define LINE_DIFF_MODIFIED 0x2
+#define LINE_DIFF_DELETED_ABOVE 0x4 // saved lines are missing before this one
+
+#define LINE_DIFF_NONE ((size_t)-1)
+#define LINE_DIFF_MAX_EDITS 1024 // larger hunks are marked without a diff
+
+// Added/modified/deleted lines against the last saved version. Both
+// versions are kept as per-line hashes. An edit rehashes the lines it touches
+// and re-diffs only the hunk around them, out to the nearest unchanged lines,
+// with Myers' algorithm. The marks stay cached, so the gutter only reads the
+// visible ones. While the buffer is clean, edits replay changes made on disk
+// and are applied to the saved version as well.
+typedef struct {
+  editor_t *editor;
+
+  uint64_t *base; // saved version
+  size_t base_count;
+  size_t base_capacity;
+
+  uint64_t *live;   // current buffer, one per line
+  size_t *base_of;  // saved line each live line equals, or LINE_DIFF_NONE
+  uint8_t *marks;   // LINE_DIFF_* bits per live line
+  size_t live_count;
+  size_t live_capacity;
+  bool tail_deleted; // saved lines are missing after the last line
+
+  long *trace; // Myers scratch
+  size_t trace_capacity;
+  uint8_t *ops;
+  size_t ops_capacity;
+} line_diff_t;
+
+line_diff_t *line_diff_create(editor_t *editor);
+void line_diff_destroy(line_diff_t *d);
+
+void line_diff_rebase(line_diff_t *d);
+uint8_t line_diff_mark(const line_diff_t *d, size_t line);
+
+#endif // !LINE_DIFF_H
@@ -0,0 +1,34 @@
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include "gap_buffer.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Byte offsets of the first character of every line, kept in sync with the
+// gap buffer on each edit so line lookups never rescan the text. Like the
+// text itself the offsets live in a gap array, with the gap at the last
+// edited line. Offsets after the gap are stored as distances from the end of
+// the text, so an edit leaves them untouched and only moving the gap to a
+// different line costs anything.
+typedef struct {
+  size_t *starts;
+  size_t count;    // lines
+  size_t capacity; // slots in starts, including the gap
+  size_t gap;      // lines before the gap
+  size_t length;   // total text length in bytes
+} line_index_t;
+
+void line_index_init(line_index_t *li);
+void line_index_free(line_index_t *li);
+void line_index_build(line_index_t *li, const gap_buffer_t *g);
+
+bool line_index_insert(line_index_t *li, size_t pos, const char *data,
+                       size_t n);
+void line_index_delete(line_index_t *li, size_t pos, size_t n);
+
+size_t line_index_line_of(const line_index_t *li, size_t pos);
+size_t line_index_line_start(const line_index_t *li, size_t line);
+size_t line_index_line_length(const line_index_t *li, size_t line);
+
+#endif // !LINE_INDEX_H
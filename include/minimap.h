@@ -0,0 +1,58 @@
+#ifndef MINIMAP_H
+#define MINIMAP_H
+
+#include "SDL_render.h"
+#include "SDL_thread.h"
+#include "editor.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MINIMAP_WIDTH 100     // pixels, one per text column
+#define MINIMAP_MAX_ROWS 4096 // texture height; longer documents downsample
+
+// Columns [start, end) of a line that hold text
+typedef struct {
+  uint8_t start;
+  uint8_t end;
+} minimap_run_t;
+
+// Cached overview of the whole document. Each pixel row shows one line at
+// 1-2 px per line, or a blend of several lines once the document has more
+// lines than MINIMAP_MAX_ROWS. Edits re-render only the rows they touch; a
+// background thread does the initial build and any re-layout. Blended rows
+// are combined from a per-line run cache, so when an edit shifts the lines
+// below it those rows are recombined without reading the text again.
+typedef struct {
+  editor_t *editor;
+
+  SDL_Texture *texture;
+  uint32_t *pixels; // MINIMAP_WIDTH x MINIMAP_MAX_ROWS, ARGB8888
+
+  // Layout, guarded by the editor lock
+  size_t line_count;
+  int px_per_line;
+  size_t lines_per_row;
+  int rows;
+
+  minimap_run_t *runs; // per line, valid for lines [0, runs_valid)
+  size_t runs_valid;
+  size_t run_capacity;
+
+  int dirty_first; // rows not yet uploaded to the texture
+  int dirty_last;
+
+  int next_row; // first row the builder still has to render
+  bool quit;
+  SDL_cond *wake;
+  SDL_Thread *builder;
+} minimap_t;
+
+minimap_t *minimap_create(SDL_Renderer *renderer, editor_t *editor);
+void minimap_destroy(minimap_t *m);
+
+void minimap_render(minimap_t *m, SDL_Renderer *renderer, int x, int height,
+                    int first_line, int visible_lines);
+int minimap_line_at(minimap_t *m, int y, int height);
+
+#endif // !MINIMAP_H
@@ -0,0 +1,18 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include "gap_buffer.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define UTF8_MAX_BYTES 4
+
+size_t utf8_decode(const char *s, size_t n, uint32_t *cp);
+bool utf8_is_combining(uint32_t cp);
+size_t utf8_count_columns(const char *s, size_t n);
+
+size_t utf8_next_grapheme(const gap_buffer_t *g, size_t pos);
+size_t utf8_prev_grapheme(const gap_buffer_t *g, size_t pos);
+
+#endif // !UTF8_H
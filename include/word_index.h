@@ -0,0 +1,71 @@
+#ifndef WORD_INDEX_H
+#define WORD_INDEX_H
+
+#include "SDL_thread.h"
+#include "editor.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WORD_INDEX_MIN_LEN 2      // shorter words are not worth completing
+#define WORD_INDEX_MAX_LEN 64     // longer runs are data, not identifiers
+#define WORD_INDEX_CHUNK (1 << 20) // bytes the builder scans per lock hold
+#define WORD_INDEX_MAX_RESULTS 16
+
+typedef struct {
+  size_t offset; // text in the arena
+  uint32_t len;
+  uint32_t hash;
+  size_t count; // occurrences in the buffer; 0 once all are deleted
+} word_entry_t;
+
+typedef struct {
+  const char *word; // points into the index; copy it before the next edit
+  size_t len;
+  size_t count;
+} word_match_t;
+
+// Frequency table of the identifiers in the buffer, for autocomplete. A
+// background thread scans the buffer once; after that each edit retokenizes
+// only the words around it. Word text lives in one arena, looked up through
+// an open-addressing hash, and is kept in a sorted id table for prefix
+// queries. New words go to an unsorted tail that is merged in once it grows;
+// the merge also drops words that no longer occur in the buffer.
+typedef struct {
+  editor_t *editor;
+
+  char *arena;
+  size_t arena_len;
+  size_t arena_cap;
+
+  word_entry_t *entries;
+  uint32_t entry_count;
+  uint32_t entry_cap;
+  uint32_t dead_count; // entries whose count fell to 0
+
+  uint32_t *slots; // entry id + 1, 0 when empty
+  size_t slot_cap;
+
+  uint32_t *sorted;      // entry ids [0, sorted_count) in text order
+  uint32_t sorted_count; // ids past it are the unsorted tail
+
+  // Edit in flight between the before and after listeners
+  size_t edit_start;
+  bool edit_counted;
+  bool edit_reset;
+
+  size_t next_pos; // first byte the builder has not scanned
+  bool done;
+  bool quit;
+  SDL_cond *wake;
+  SDL_Thread *builder;
+} word_index_t;
+
+word_index_t *word_index_create(editor_t *editor);
+void word_index_destroy(word_index_t *wi);
+
+size_t word_index_complete(word_index_t *wi, const char *prefix, size_t n,
+                           word_match_t *out, size_t max);
+size_t word_index_prefix_at(const editor_t *editor, size_t pos, char *out);
+
+#endif // !WORD_INDEX_H
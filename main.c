@@ -20,12 +20,39 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "include/batch.h"
+#include "include/bracket_tree.h"
+#include "include/clipboard.h"
 #include "include/editor.h"
+#include "include/file_watch.h"
+#include "include/minimap.h"
+#include "include/word_index.h"
 #include "include/gap_buffer.h"
+#include "include/line_diff.h"
 
 #define FONT "JetBrainsMono-Regular.ttf"
 #define TAB_WIDTH 4
 #define LINE_NUMBER_WIDTH 50
+#define COMPLETION_ROWS 8
+
+// Suggestions for the word being typed, copied out of the word index so
+// they can be drawn without the editor lock
+typedef struct {
+  char words[COMPLETION_ROWS][WORD_INDEX_MAX_LEN + 1];
+  int count; // 0 while hidden
+  size_t prefix_len;
+} completion_t;
+
+// Companions of the open editor; the pointers are NULL when unavailable
+typedef struct {
+  file_watch_t *watch;
+  minimap_t *minimap;
+  bracket_tree_t *brackets;
+  clipboard_t *clipboard;
+  word_index_t *words;
+  line_diff_t *diff;
+  completion_t completion;
+} views_t;
 
 typedef struct {
   SDL_Window *window;
@@ -38,49 +65,6 @@ typedef struct {
   } Font;
 } sdl_t;
 
-typedef struct {
-  char **lines;
-  int count;
-} lines_t;
-
-lines_t split_lines(const char *text) {
-  lines_t L = {0};
-
-  if (!text)
-    return L;
-
-  // Count line
-  int count = 1;
-  for (const char *p = text; *p; p++) {
-    if (*p == '\n')
-      count++;
-  }
-
-  L.count = count;
-  L.lines = malloc(sizeof(char *) * count);
-  L.lines[0] = "";
-
-  int idx = 0;
-  const char *start = text;
-
-  for (const char *p = text;; p++) {
-    if (*p == '\n' || *p == '\0') {
-      int len = p - start;
-      char *line = malloc(len + 1);
-      memcpy(line, start, len);
-      line[len] = '\0';
-      L.lines[idx++] = line;
-
-      if (*p == '\0')
-        break;
-
-      start = p + 1;
-    }
-  }
-
-  return L;
-}
-
 void editor_ensure_cursor_visible(editor_t *editor, sdl_t *sdl,
                                   int line_hieght) {
   int lines_visible = sdl->window_height / line_hieght;
@@ -101,7 +85,8 @@ void editor_ensure_cursor_visible(editor_t *editor, sdl_t *sdl,
 
 void editor_ensure_cursor_visible_horizontal(editor_t *editor, sdl_t *sdl,
                                              int char_w) {
-  int cols_visible = (sdl->window_width - LINE_NUMBER_WIDTH - 5) / char_w;
+  int cols_visible =
+      (sdl->window_width - LINE_NUMBER_WIDTH - MINIMAP_WIDTH - 5) / char_w;
 
   // scroll right
   if (editor->cursor_col >= editor->scroll_x + cols_visible) {
@@ -175,7 +160,49 @@ void final_cleanup(sdl_t *sdl, editor_t *e) {
   SDL_Quit();
 }
 
-void handle_input(editor_t *editor, sdl_t *sdl) {
+// Center the view on the line under `y` in the minimap column
+void minimap_jump(editor_t *editor, sdl_t *sdl, minimap_t *minimap, int y,
+                  int line_h) {
+  int line = minimap_line_at(minimap, y, sdl->window_height);
+  int lines_visible = sdl->window_height / line_h;
+
+  editor->scroll_y = line - lines_visible / 2;
+  if (editor->scroll_y < 0)
+    editor->scroll_y = 0;
+}
+
+// Look up completions for the word ending at the caret
+void update_completion(editor_t *editor, views_t *views) {
+  completion_t *c = &views->completion;
+  c->count = 0;
+  if (!views->words || editor->selecting)
+    return;
+
+  char prefix[WORD_INDEX_MAX_LEN];
+  size_t n = word_index_prefix_at(editor, editor->buffer->gap_start, prefix);
+  if (n < WORD_INDEX_MIN_LEN)
+    return;
+
+  word_match_t matches[COMPLETION_ROWS];
+  size_t found = word_index_complete(views->words, prefix, n, matches,
+                                     COMPLETION_ROWS);
+  for (size_t i = 0; i < found; i++) {
+    memcpy(c->words[i], matches[i].word, matches[i].len);
+    c->words[i][matches[i].len] = '\0';
+  }
+  c->count = found;
+  c->prefix_len = n;
+}
+
+// Shift turns a caret movement into a selection change
+void move_caret(editor_t *editor, SDL_Keymod mod, void (*move)(editor_t *)) {
+  if (mod & KMOD_SHIFT)
+    editor_select_with(editor, move);
+  else
+    move(editor);
+}
+
+void handle_input(editor_t *editor, sdl_t *sdl, views_t *views) {
   SDL_Event event;
 
   int line_h = TTF_FontHeight(sdl->Font.font);
@@ -186,10 +213,24 @@ void handle_input(editor_t *editor, sdl_t *sdl) {
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
     case SDL_TEXTINPUT:
-
-      editor_insert_char(editor, event.text.text[0]);
+      // the event carries one whole UTF-8 sequence, possibly several
+      editor_insert_text(editor, event.text.text, strlen(event.text.text));
       editor_ensure_cursor_visible(editor, sdl, line_h);
       editor_ensure_cursor_visible_horizontal(editor, sdl, char_w);
+      update_completion(editor, views);
+      return;
+    case SDL_MOUSEBUTTONDOWN:
+      if (views->minimap && event.button.button == SDL_BUTTON_LEFT &&
+          event.button.x >= sdl->window_width - MINIMAP_WIDTH) {
+        minimap_jump(editor, sdl, views->minimap, event.button.y, line_h);
+      }
+      return;
+    case SDL_MOUSEMOTION:
+      // dragging inside the minimap scrolls along
+      if (views->minimap && (event.motion.state & SDL_BUTTON_LMASK) &&
+          event.motion.x >= sdl->window_width - MINIMAP_WIDTH) {
+        minimap_jump(editor, sdl, views->minimap, event.motion.y, line_h);
+      }
       return;
     case SDL_WINDOWEVENT:
       if (event.window.event == SDL_WINDOWEVENT_RESIZED ||
@@ -206,8 +247,21 @@ void handle_input(editor_t *editor, sdl_t *sdl) {
         SDL_SetWindowSize(sdl->window, width, height);
         SDL_RenderSetViewport(sdl->renderer, NULL);
       }
+      // another application may paste a copy we have not published yet
+      if (event.window.event == SDL_WINDOWEVENT_FOCUS_LOST &&
+          views->clipboard) {
+        clipboard_publish(views->clipboard);
+      }
+      return;
+    case SDL_CLIPBOARDUPDATE:
+      if (views->clipboard)
+        clipboard_forget(views->clipboard);
       return;
-    case SDL_KEYDOWN:
+    case SDL_KEYDOWN: {
+      // every key press closes the suggestions; Backspace and Tab see them
+      int suggestions = views->completion.count;
+      views->completion.count = 0;
+
       switch (event.key.keysym.sym) {
       case SDLK_RETURN:
       case SDLK_KP_ENTER:
@@ -215,21 +269,21 @@ void handle_input(editor_t *editor, sdl_t *sdl) {
         editor_ensure_cursor_visible(editor, sdl, line_h);
         break;
       case SDLK_LEFT:
-        editor_move_left(editor);
+        move_caret(editor, event.key.keysym.mod, editor_move_left);
         editor_ensure_cursor_visible(editor, sdl, line_h);
         editor_ensure_cursor_visible_horizontal(editor, sdl, char_w);
         break;
       case SDLK_RIGHT:
-        editor_move_right(editor);
+        move_caret(editor, event.key.keysym.mod, editor_move_right);
         editor_ensure_cursor_visible(editor, sdl, line_h);
         editor_ensure_cursor_visible_horizontal(editor, sdl, char_w);
         break;
       case SDLK_UP:
-        editor_move_up(editor);
+        move_caret(editor, event.key.keysym.mod, editor_move_up);
         editor_ensure_cursor_visible(editor, sdl, line_h);
         break;
       case SDLK_DOWN:
-        editor_move_down(editor);
+        move_caret(editor, event.key.keysym.mod, editor_move_down);
         editor_ensure_cursor_visible(editor, sdl, line_h);
         break;
 
@@ -237,13 +291,66 @@ void handle_input(editor_t *editor, sdl_t *sdl) {
         editor_backspace(editor);
         editor_ensure_cursor_visible(editor, sdl, line_h);
         editor_ensure_cursor_visible_horizontal(editor, sdl, char_w);
+        if (suggestions)
+          update_completion(editor, views);
         break;
       case SDLK_TAB:
-        for (int i = 0; i < TAB_WIDTH; i++) {
-          editor_insert_char(editor, ' ');
+        if (suggestions) {
+          // Tab completes the top suggestion
+          const char *word = views->completion.words[0];
+          size_t n = views->completion.prefix_len;
+          editor_insert_text(editor, word + n, strlen(word) - n);
+        } else {
+          for (int i = 0; i < TAB_WIDTH; i++) {
+            editor_insert_char(editor, ' ');
+          }
         }
         editor_ensure_cursor_visible_horizontal(editor, sdl, char_w);
         break;
+      case SDLK_RIGHTBRACKET:
+        // Ctrl+] jumps to the bracket matching the one at the caret
+        if (views->brackets && (event.key.keysym.mod & KMOD_CTRL)) {
+          size_t bracket, match;
+          if (bracket_tree_match_near(views->brackets, editor_caret(editor),
+                                      &bracket, &match)) {
+            editor_move_to(editor, match);
+            editor_ensure_cursor_visible(editor, sdl, line_h);
+            editor_ensure_cursor_visible_horizontal(editor, sdl, char_w);
+          }
+        }
+        break;
+      case SDLK_s:
+        // Ctrl+S; the watcher rehashes so our own write is not reloaded
+        if ((event.key.keysym.mod & KMOD_CTRL) && editor->path &&
+            editor_save(editor, editor->path)) {
+          if (views->watch)
+            file_watch_resync(views->watch, editor);
+          if (views->diff)
+            line_diff_rebase(views->diff);
+        }
+        break;
+      case SDLK_a:
+        if (event.key.keysym.mod & KMOD_CTRL)
+          editor_select_all(editor);
+        break;
+      case SDLK_c:
+        if (views->clipboard && (event.key.keysym.mod & KMOD_CTRL))
+          clipboard_copy_selection(views->clipboard);
+        break;
+      case SDLK_x:
+        if (views->clipboard && (event.key.keysym.mod & KMOD_CTRL) &&
+            clipboard_cut_selection(views->clipboard)) {
+          editor_ensure_cursor_visible(editor, sdl, line_h);
+          editor_ensure_cursor_visible_horizontal(editor, sdl, char_w);
+        }
+        break;
+      case SDLK_v:
+        if (views->clipboard && (event.key.keysym.mod & KMOD_CTRL) &&
+            clipboard_paste(views->clipboard)) {
+          editor_ensure_cursor_visible(editor, sdl, line_h);
+          editor_ensure_cursor_visible_horizontal(editor, sdl, char_w);
+        }
+        break;
       case SDLK_ESCAPE:
         editor->state = QUIT;
         return;
@@ -251,6 +358,7 @@ void handle_input(editor_t *editor, sdl_t *sdl) {
 
       return;
     }
+    }
   }
 }
 
@@ -270,9 +378,9 @@ void clear_screen(const sdl_t sdl) {
 
 SDL_Texture *render_text(SDL_Renderer *renderer, TTF_Font *font,
                          const char *msg, SDL_Color color, SDL_Rect *out_rect) {
-  SDL_Surface *surface = TTF_RenderText_Blended(font, msg, color);
+  SDL_Surface *surface = TTF_RenderUTF8_Blended(font, msg, color);
   if (!surface) {
-    SDL_Log("TTF_RenderText_Blended error: %s", TTF_GetError());
+    SDL_Log("TTF_RenderUTF8_Blended error: %s", TTF_GetError());
     return NULL;
   }
 
@@ -318,6 +426,104 @@ void render_cursor(editor_t *editor, sdl_t *sdl, int char_h, int char_w) {
   SDL_RenderFillRect(sdl->renderer, &caret);
 }
 
+// List the suggestions under the caret, top one highlighted
+void render_completion(editor_t *editor, sdl_t *sdl,
+                       const completion_t *completion, int char_h,
+                       int char_w) {
+  int visible_line = editor->cursor_line - editor->scroll_y;
+  int visible_col =
+      editor->cursor_col - editor->scroll_x - (int)completion->prefix_len;
+  if (completion->count == 0 || visible_line < 0)
+    return;
+  if (visible_col < 0)
+    visible_col = 0;
+
+  int width = 0;
+  for (int i = 0; i < completion->count; i++) {
+    int w = strlen(completion->words[i]) * char_w;
+    if (w > width)
+      width = w;
+  }
+
+  int x = LINE_NUMBER_WIDTH + 5 + visible_col * char_w;
+  int y = 20 + (visible_line + 1) * char_h;
+  SDL_Rect box = {x - 2, y, width + 4, completion->count * char_h};
+  SDL_SetRenderDrawColor(sdl->renderer, 45, 45, 45, 255);
+  SDL_RenderFillRect(sdl->renderer, &box);
+
+  SDL_Color normal = {200, 200, 200, 255};
+  SDL_Color top = {255, 255, 255, 255};
+  for (int i = 0; i < completion->count; i++) {
+    if (i == 0) {
+      SDL_Rect row = {x - 2, y, width + 4, char_h};
+      SDL_SetRenderDrawColor(sdl->renderer, 38, 79, 120, 255);
+      SDL_RenderFillRect(sdl->renderer, &row);
+    }
+
+    SDL_Rect rect = {x, y + i * char_h, 0, 0};
+    SDL_Texture *text =
+        render_text(sdl->renderer, sdl->Font.font, completion->words[i],
+                    i == 0 ? top : normal, &rect);
+    if (text) {
+      SDL_RenderCopy(sdl->renderer, text, NULL, &rect);
+      SDL_DestroyTexture(text);
+    }
+  }
+}
+
+// Outline the character cell at byte offset `pos`, if it is on screen
+void render_char_box(editor_t *editor, sdl_t *sdl, size_t pos, int char_h,
+                     int char_w) {
+  int line = line_index_line_of(&editor->lines, pos);
+  int col = editor_byte_to_col(editor, line,
+                               pos - line_index_line_start(&editor->lines, line));
+
+  int visible_line = line - editor->scroll_y;
+  int visible_col = col - editor->scroll_x;
+  if (visible_line < 0 || visible_col < 0)
+    return;
+
+  SDL_Rect box = {LINE_NUMBER_WIDTH + 5 + visible_col * char_w,
+                  20 + visible_line * char_h, char_w, char_h};
+  SDL_SetRenderDrawColor(sdl->renderer, 140, 140, 140, 255);
+  SDL_RenderDrawRect(sdl->renderer, &box);
+}
+
+// Shade the selected part of a line, clipped to the visible columns
+void render_selection(editor_t *editor, sdl_t *sdl, int line, int y,
+                      int char_w, int line_h, int cols_visible) {
+  size_t start, end;
+  if (!editor_get_selection(editor, &start, &end))
+    return;
+
+  size_t line_start = line_index_line_start(&editor->lines, line);
+  size_t line_end = line_start + line_index_line_length(&editor->lines, line);
+  if (end < line_start || start > line_end)
+    return;
+
+  int first = start > line_start
+                  ? editor_byte_to_col(editor, line, start - line_start)
+                  : 0;
+  // include the newline when the selection runs past it
+  int last = end <= line_end
+                 ? editor_byte_to_col(editor, line, end - line_start)
+                 : editor_get_line_length(editor, line) + 1;
+
+  first -= editor->scroll_x;
+  last -= editor->scroll_x;
+  if (first < 0)
+    first = 0;
+  if (last > cols_visible)
+    last = cols_visible;
+  if (last <= first)
+    return;
+
+  SDL_Rect box = {LINE_NUMBER_WIDTH + 5 + first * char_w, y,
+                  (last - first) * char_w, line_h};
+  SDL_SetRenderDrawColor(sdl->renderer, 38, 79, 120, 255);
+  SDL_RenderFillRect(sdl->renderer, &box);
+}
+
 void render_line_number(sdl_t *sdl, int line_index, SDL_Color color, int y,
                         int char_w) {
   // render line line_number
@@ -341,6 +547,25 @@ void render_line_number(sdl_t *sdl, int line_index, SDL_Color color, int y,
   }
 }
 
+// Bar at the gutter edge for lines changed since the last save, and a
+// notch where saved lines were deleted
+void render_diff_marker(sdl_t *sdl, uint8_t mark, int y, int line_h) {
+  if (mark & (LINE_DIFF_ADDED | LINE_DIFF_MODIFIED)) {
+    if (mark & LINE_DIFF_ADDED)
+      SDL_SetRenderDrawColor(sdl->renderer, 80, 160, 80, 255);
+    else
+      SDL_SetRenderDrawColor(sdl->renderer, 70, 130, 200, 255);
+    SDL_Rect bar = {LINE_NUMBER_WIDTH - 3, y, 3, line_h};
+    SDL_RenderFillRect(sdl->renderer, &bar);
+  }
+
+  if (mark & LINE_DIFF_DELETED_ABOVE) {
+    SDL_SetRenderDrawColor(sdl->renderer, 200, 80, 80, 255);
+    SDL_Rect notch = {LINE_NUMBER_WIDTH - 8, y - 1, 8, 3};
+    SDL_RenderFillRect(sdl->renderer, &notch);
+  }
+}
+
 void draw_line_number_background(sdl_t *sdl) {
   // --- draw line-number gutter background ---
   SDL_SetRenderDrawColor(sdl->renderer, 40, 40, 40, 255); // dark grey
@@ -349,14 +574,19 @@ void draw_line_number_background(sdl_t *sdl) {
 }
 
 int main(int argc, char *argv[]) {
-  (void)argc;
-  (void)argv;
+  // Headless mode never opens a window
+  if (argc > 1 && strcmp(argv[1], "--batch") == 0)
+    return batch_run(argc - 2, argv + 2);
 
   SDL_Color white = {255, 255, 255, 255};
   SDL_Color light_gray = {180, 180, 180, 255};
 
   editor_t *editor = editor_create(1024);
 
+  views_t views = {0};
+  if (argc > 1 && editor_open_file(editor, argv[1]))
+    views.watch = file_watch_create(editor);
+
   sdl_t sdl = {0};
   if (!init_sdl(&sdl))
     exit(EXIT_FAILURE);
@@ -364,54 +594,71 @@ int main(int argc, char *argv[]) {
   int char_w = 0, char_h = 0;
   TTF_SizeText(sdl.Font.font, "A", &char_w, &char_h);
 
+  int line_h = TTF_FontHeight(sdl.Font.font);
+
+  views.minimap = minimap_create(sdl.renderer, editor);
+  views.brackets = bracket_tree_create(editor);
+  views.clipboard = clipboard_create(editor);
+  views.words = word_index_create(editor);
+  views.diff = line_diff_create(editor);
+
   while (editor->state != QUIT) {
-    handle_input(editor, &sdl);
+    // Background workers read the buffer; edits happen under the lock
+    editor_lock(editor);
+    handle_input(editor, &sdl, &views);
+
+    if (views.watch && file_watch_poll(views.watch, editor))
+      editor_ensure_cursor_visible(editor, &sdl, line_h);
+    editor_unlock(editor);
+
     clear_screen(sdl);
 
     draw_line_number_background(&sdl);
 
-    char *msg = malloc(editor->buffer->capacity);
-    gap_to_string(editor->buffer, msg);
-
     uint32_t now = SDL_GetTicks();
     if (now - editor->last_blink > 500) {
       editor->cursor_visible = !editor->cursor_visible;
       editor->last_blink = now;
     }
 
-    lines_t L = split_lines(msg);
-
     int y = 20;
-
-    int line_h = TTF_FontHeight(sdl.Font.font);
+    int line_count = editor_count_lines(editor);
 
     // int cols_visible = (sdl.window_width - LINE_NUMBER_WIDTH) / char_w;
 
-    for (int i = editor->scroll_y; i < L.count; i++) {
+    // Only the visible lines are copied out of the buffer
+    for (int i = editor->scroll_y; i < line_count; i++) {
 
       // stop when we draw outside the window
       if (y > sdl.window_height)
         break;
 
-      const char *line = L.lines[i];
-      if (line[0] == '\0') {
-        line = " ";
-      }
-
-      render_line_number(&sdl, i, light_gray, y, char_w);
+      int cols_visible =
+          (sdl.window_width - LINE_NUMBER_WIDTH - MINIMAP_WIDTH - 5) / char_w;
 
-      // Horizontal Scrolling
+      // Horizontal Scrolling, in display columns
       int visible_start = editor->scroll_x;
-      int line_len = strlen(line);
+      int line_len = editor_get_line_length(editor, i);
       if (visible_start > line_len)
         visible_start = line_len;
 
-      int cols_visible = (sdl.window_width - LINE_NUMBER_WIDTH - 5) / char_w;
       if (line_len <= cols_visible) {
         editor->scroll_x = 0;
       }
-      // pointer to visible substring
-      const char *visible_text = line + editor->scroll_x;
+
+      // only the on-screen slice of the line is copied out
+      char *visible_text =
+          editor_get_line_columns(editor, i, visible_start, cols_visible + 1);
+      if (!visible_text)
+        break;
+
+      render_line_number(&sdl, i, light_gray, y, char_w);
+      if (views.diff) {
+        render_diff_marker(&sdl, line_diff_mark(views.diff, i), y, line_h);
+        if (i == line_count - 1 && views.diff->tail_deleted)
+          render_diff_marker(&sdl, LINE_DIFF_DELETED_ABOVE, y + line_h, line_h);
+      }
+      render_selection(editor, &sdl, i, y, char_w, line_h, cols_visible);
 
       // render the actual text
       if (visible_text[0] != '\0') {
@@ -425,24 +672,39 @@ int main(int argc, char *argv[]) {
         }
       }
 
+      free(visible_text);
       y += line_h;
     }
 
+    size_t bracket, match;
+    if (views.brackets && bracket_tree_match_near(views.brackets,
+                                                  editor_caret(editor),
+                                                  &bracket, &match)) {
+      render_char_box(editor, &sdl, bracket, char_h, char_w);
+      render_char_box(editor, &sdl, match, char_h, char_w);
+    }
+
+    if (views.minimap) {
+      minimap_render(views.minimap, sdl.renderer, sdl.window_width - MINIMAP_WIDTH,
+                     sdl.window_height, editor->scroll_y,
+                     sdl.window_height / line_h);
+    }
+
     if (editor->cursor_visible) {
       render_cursor(editor, &sdl, char_h, char_w);
     }
 
-    SDL_RenderPresent(sdl.renderer);
+    render_completion(editor, &sdl, &views.completion, char_h, char_w);
 
-    for (int i = 0; i < L.count; i++) {
-      free(L.lines[i]);
-    }
-    free(L.lines);
-    free(msg);
+    SDL_RenderPresent(sdl.renderer);
   }
 
-  gap_print(editor->buffer);
-
+  line_diff_destroy(views.diff);
+  word_index_destroy(views.words);
+  clipboard_destroy(views.clipboard);
+  bracket_tree_destroy(views.brackets);
+  minimap_destroy(views.minimap);
+  file_watch_destroy(views.watch);
   final_cleanup(&sdl, editor);
   return 0;
 }
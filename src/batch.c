@@ -0,0 +1,539 @@
+#include "../include/batch.h"
+#include "../include/editor.h"
+#include "SDL_cpuinfo.h"
+#include "SDL_thread.h"
+#include "SDL_timer.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Headless batch editing:
+//
+//   text-editor --batch [-j N] SCRIPT FILE... [@LIST]...
+//
+// SCRIPT holds one operation per line, of at most BATCH_LINE_MAX bytes;
+// blank lines and lines starting with '#' are skipped. Text arguments
+// understand \n, \t, \s (space) and \\.
+//
+//   goto LINE[:COL]   caret to 1-based LINE (and COL), or `goto end`
+//   insert TEXT       insert TEXT at the caret and move past it
+//   delete N          delete N bytes after the caret
+//   replace OLD NEW   replace every OLD with NEW
+//
+// @LIST reads one file path per line. Every file gets its own editor and is
+// saved in place when the script changed it.
+
+#define BATCH_LINE_MAX 4096
+
+// Unescape `src` into a new string; returns NULL on a bad escape.
+static char *batch_unescape(const char *src, size_t *out_len) {
+  size_t len = strlen(src);
+  char *out = malloc(len + 1);
+  if (!out)
+    return NULL;
+
+  size_t n = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (src[i] != '\\') {
+      out[n++] = src[i];
+      continue;
+    }
+    switch (src[++i]) {
+    case 'n':
+      out[n++] = '\n';
+      break;
+    case 't':
+      out[n++] = '\t';
+      break;
+    case 's':
+      out[n++] = ' ';
+      break;
+    case '\\':
+      out[n++] = '\\';
+      break;
+    default:
+      free(out);
+      return NULL;
+    }
+  }
+  out[n] = '\0';
+  *out_len = n;
+  return out;
+}
+
+// Parse a decimal number that runs up to `end`, a separator or '\0'. Signs,
+// blanks and trailing junk are rejected.
+static bool batch_parse_number(const char *s, char end, size_t *out) {
+  if (*s < '0' || *s > '9')
+    return false;
+  char *stop;
+  errno = 0;
+  unsigned long long n = strtoull(s, &stop, 10);
+  if (*stop != end || errno == ERANGE || n > SIZE_MAX)
+    return false;
+  *out = n;
+  return true;
+}
+
+static bool batch_parse_line(batch_op_t *op, char *line) {
+  char *verb = strtok(line, " ");
+  char *arg = strtok(NULL, " ");
+  char *arg2 = strtok(NULL, " ");
+
+  memset(op, 0, sizeof(*op));
+  if (!verb || !arg)
+    return false;
+
+  if (strcmp(verb, "goto") == 0) {
+    op->kind = BATCH_GOTO;
+    if (strcmp(arg, "end") == 0)
+      return !arg2;
+    char *colon = strchr(arg, ':');
+    op->col = 1;
+    if (!batch_parse_number(arg, colon ? ':' : '\0', &op->line) ||
+        (colon && !batch_parse_number(colon + 1, '\0', &op->col)))
+      return false;
+    return op->line > 0 && op->col > 0 && !arg2;
+  }
+  if (strcmp(verb, "insert") == 0) {
+    op->kind = BATCH_INSERT;
+    op->text = batch_unescape(arg, &op->text_len);
+    return op->text && !arg2;
+  }
+  if (strcmp(verb, "delete") == 0) {
+    op->kind = BATCH_DELETE;
+    return batch_parse_number(arg, '\0', &op->count) && !arg2;
+  }
+  if (strcmp(verb, "replace") == 0 && arg2) {
+    op->kind = BATCH_REPLACE;
+    op->text = batch_unescape(arg, &op->text_len);
+    op->with = batch_unescape(arg2, &op->with_len);
+    return op->text && op->with && op->text_len > 0 && !strtok(NULL, " ");
+  }
+  return false;
+}
+
+bool batch_script_load(batch_script_t *script, const char *path) {
+  script->ops = NULL;
+  script->count = 0;
+
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "Could not open script %s.\n", path);
+    return false;
+  }
+
+  char line[BATCH_LINE_MAX];
+  size_t capacity = 0;
+  int line_no = 0;
+  bool ok = true;
+
+  while (ok && fgets(line, sizeof(line), f)) {
+    line_no++;
+
+    // A full buffer without the newline is only fine at the end of the file
+    size_t len = strlen(line);
+    if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+      int c = fgetc(f);
+      if (c == '\r')
+        c = fgetc(f);
+      if (c != EOF && c != '\n') {
+        fprintf(stderr, "%s:%d: line longer than %d bytes.\n", path, line_no,
+                BATCH_LINE_MAX - 1);
+        ok = false;
+        break;
+      }
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0' || line[0] == '#')
+      continue;
+
+    if (script->count == capacity) {
+      capacity = capacity ? capacity * 2 : 16;
+      batch_op_t *ops = realloc(script->ops, capacity * sizeof(batch_op_t));
+      if (!ops) {
+        ok = false;
+        break;
+      }
+      script->ops = ops;
+    }
+
+    batch_op_t *op = &script->ops[script->count];
+    if (!batch_parse_line(op, line)) {
+      fprintf(stderr, "%s:%d: bad operation.\n", path, line_no);
+      free(op->text);
+      free(op->with);
+      ok = false;
+      break;
+    }
+    script->count++;
+  }
+
+  fclose(f);
+  if (!ok)
+    batch_script_free(script);
+  return ok;
+}
+
+void batch_script_free(batch_script_t *script) {
+  for (size_t i = 0; i < script->count; i++) {
+    free(script->ops[i].text);
+    free(script->ops[i].with);
+  }
+  free(script->ops);
+  script->ops = NULL;
+  script->count = 0;
+}
+
+// Rewrite the whole buffer in one pass and hand it back as a single edit,
+// rather than splicing every match into the gap buffer separately. The caret
+// stays on the same text; inside a match it goes to the start of the
+// replacement. Returns false when out of memory.
+static bool batch_replace_all(editor_t *e, const batch_op_t *op) {
+  gap_buffer_t *g = e->buffer;
+  size_t len = e->lines.length;
+  size_t caret = g->gap_start;
+
+  // With the gap at the end the text is one contiguous run
+  gap_move_to(g, len);
+  const char *text = g->buffer;
+
+  size_t matches = 0;
+  for (size_t i = 0; i + op->text_len <= len;) {
+    const char *p = memchr(text + i, op->text[0], len - i);
+    if (!p || (size_t)(p - text) + op->text_len > len)
+      break;
+    i = p - text;
+    if (memcmp(p, op->text, op->text_len) == 0) {
+      matches++;
+      i += op->text_len;
+    } else {
+      i++;
+    }
+  }
+
+  if (matches == 0) {
+    gap_move_to(g, caret);
+    return true;
+  }
+
+  size_t out_len = len - matches * op->text_len + matches * op->with_len;
+  char *out = malloc(out_len ? out_len : 1);
+  if (!out) {
+    gap_move_to(g, caret);
+    return false;
+  }
+
+  size_t n = 0, new_caret = out_len;
+  for (size_t i = 0; i < len;) {
+    if (i == caret)
+      new_caret = n;
+    if (i + op->text_len <= len && text[i] == op->text[0] &&
+        memcmp(text + i, op->text, op->text_len) == 0) {
+      if (caret > i && caret < i + op->text_len)
+        new_caret = n;
+      memcpy(out + n, op->with, op->with_len);
+      n += op->with_len;
+      i += op->text_len;
+    } else {
+      out[n++] = text[i++];
+    }
+  }
+
+  bool ok = editor_replace_range(e, 0, len, out, out_len);
+  free(out);
+  editor_move_to(e, ok ? new_caret : caret);
+  return ok;
+}
+
+// Run the script over one editor. Edits mark it dirty; returns false when
+// one ran out of memory.
+static bool batch_apply(editor_t *e, const batch_script_t *script) {
+  bool ok = true;
+
+  for (size_t i = 0; i < script->count && ok; i++) {
+    const batch_op_t *op = &script->ops[i];
+    size_t pos = e->buffer->gap_start;
+
+    switch (op->kind) {
+    case BATCH_GOTO:
+      if (op->line == 0) {
+        editor_move_to(e, e->lines.length);
+      } else {
+        size_t line = op->line - 1;
+        if (line >= e->lines.count)
+          line = e->lines.count - 1;
+        size_t col = op->col - 1;
+        size_t line_len = line_index_line_length(&e->lines, line);
+        if (col > line_len)
+          col = line_len;
+        editor_move_to(e, line_index_line_start(&e->lines, line) + col);
+      }
+      break;
+    case BATCH_INSERT:
+      ok = editor_replace_range(e, pos, 0, op->text, op->text_len);
+      if (ok)
+        editor_move_to(e, pos + op->text_len);
+      break;
+    case BATCH_DELETE:
+      ok = editor_replace_range(e, pos, op->count, "", 0);
+      break;
+    case BATCH_REPLACE:
+      ok = batch_replace_all(e, op);
+      break;
+    }
+  }
+
+  return ok;
+}
+
+// Files still queued for one worker, [head, tail) into the file list. The
+// owner takes from the head; idle workers steal half from the tail.
+typedef struct {
+  SDL_mutex *lock;
+  size_t head;
+  size_t tail;
+} batch_queue_t;
+
+typedef struct {
+  const batch_script_t *script;
+  char **files;
+  batch_queue_t *queues;
+  int worker_count;
+} batch_job_t;
+
+typedef struct {
+  batch_job_t *job;
+  int id;
+  size_t files;
+  size_t failed;
+  size_t bytes_in;
+  size_t bytes_out;
+} batch_worker_t;
+
+static bool batch_take(batch_job_t *job, int id, size_t *file) {
+  batch_queue_t *own = &job->queues[id];
+
+  SDL_LockMutex(own->lock);
+  bool found = own->head < own->tail;
+  if (found)
+    *file = own->head++;
+  SDL_UnlockMutex(own->lock);
+  if (found)
+    return true;
+
+  for (int i = 1; i < job->worker_count; i++) {
+    batch_queue_t *victim = &job->queues[(id + i) % job->worker_count];
+
+    SDL_LockMutex(victim->lock);
+    size_t left = victim->tail - victim->head;
+    size_t steal = (left + 1) / 2;
+    size_t end = victim->tail;
+    victim->tail -= steal;
+    SDL_UnlockMutex(victim->lock);
+
+    if (steal == 0)
+      continue;
+
+    SDL_LockMutex(own->lock);
+    own->head = end - steal;
+    own->tail = end;
+    *file = own->head++;
+    SDL_UnlockMutex(own->lock);
+    return true;
+  }
+
+  return false;
+}
+
+static int batch_worker(void *data) {
+  batch_worker_t *w = data;
+  batch_job_t *job = w->job;
+  size_t file;
+
+  while (batch_take(job, w->id, &file)) {
+    const char *path = job->files[file];
+    editor_t *e = editor_create(1024);
+    w->files++;
+
+    if (!e || !e->buffer || !editor_open_file(e, path)) {
+      w->failed++;
+      editor_destory(e);
+      continue;
+    }
+    w->bytes_in += e->lines.length;
+
+    if (!batch_apply(e, job->script))
+      w->failed++;
+    else if (e->dirty && editor_save(e, path))
+      w->bytes_out += e->lines.length;
+    else if (e->dirty)
+      w->failed++;
+
+    editor_destory(e);
+  }
+
+  return 0;
+}
+
+// Append the paths named on the command line, expanding @LIST files.
+static bool batch_collect(char ***files, size_t *count, size_t *capacity,
+                          const char *arg) {
+  if (arg[0] != '@') {
+    if (*count == *capacity) {
+      *capacity = *capacity ? *capacity * 2 : 64;
+      char **grown = realloc(*files, *capacity * sizeof(char *));
+      if (!grown)
+        return false;
+      *files = grown;
+    }
+    size_t len = strlen(arg);
+    char *copy = malloc(len + 1);
+    if (!copy)
+      return false;
+    memcpy(copy, arg, len + 1);
+    (*files)[(*count)++] = copy;
+    return true;
+  }
+
+  FILE *f = fopen(arg + 1, "r");
+  if (!f) {
+    fprintf(stderr, "Could not open file list %s.\n", arg + 1);
+    return false;
+  }
+  char line[BATCH_LINE_MAX];
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] != '\0')
+      ok = batch_collect(files, count, capacity, line);
+  }
+  fclose(f);
+  return ok;
+}
+
+static int batch_compare_paths(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Two workers saving the same file would race on it, so every file may be
+// named only once, however it is spelled. Returns false after reporting a
+// duplicate.
+static bool batch_check_unique(char **files, size_t count) {
+  char **real = calloc(count ? count : 1, sizeof(char *));
+  bool ok = real != NULL;
+
+  for (size_t i = 0; ok && i < count; i++) {
+    real[i] = editor_resolve_path(files[i]);
+    ok = real[i] != NULL;
+  }
+  if (ok) {
+    qsort(real, count, sizeof(char *), batch_compare_paths);
+    for (size_t i = 1; ok && i < count; i++) {
+      if (strcmp(real[i - 1], real[i]) == 0) {
+        fprintf(stderr, "batch: %s is listed more than once.\n", real[i]);
+        ok = false;
+      }
+    }
+  } else {
+    fprintf(stderr, "batch: out of memory.\n");
+  }
+
+  for (size_t i = 0; real && i < count; i++)
+    free(real[i]);
+  free(real);
+  return ok;
+}
+
+int batch_run(int argc, char *argv[]) {
+  int workers = SDL_GetCPUCount();
+  int arg = 0;
+
+  if (arg + 1 < argc && strcmp(argv[arg], "-j") == 0) {
+    workers = atoi(argv[arg + 1]);
+    arg += 2;
+  }
+  if (arg >= argc || workers < 1) {
+    fprintf(stderr, "usage: text-editor --batch [-j N] SCRIPT FILE... "
+                    "[@LIST]...\n");
+    return EXIT_FAILURE;
+  }
+
+  batch_script_t script;
+  if (!batch_script_load(&script, argv[arg++]))
+    return EXIT_FAILURE;
+
+  char **files = NULL;
+  size_t count = 0, capacity = 0;
+  bool collected = true;
+  for (; arg < argc && collected; arg++)
+    collected = batch_collect(&files, &count, &capacity, argv[arg]);
+  if (!collected || !batch_check_unique(files, count)) {
+    for (size_t i = 0; i < count; i++)
+      free(files[i]);
+    free(files);
+    batch_script_free(&script);
+    return EXIT_FAILURE;
+  }
+  if ((size_t)workers > count)
+    workers = count ? count : 1;
+
+  batch_queue_t *queues = calloc(workers, sizeof(batch_queue_t));
+  batch_worker_t *pool = calloc(workers, sizeof(batch_worker_t));
+  SDL_Thread **threads = calloc(workers, sizeof(SDL_Thread *));
+  batch_job_t job = {&script, files, queues, workers};
+
+  // Deal out contiguous ranges; stealing evens out uneven file sizes
+  for (int i = 0; i < workers && queues; i++) {
+    queues[i].lock = SDL_CreateMutex();
+    queues[i].head = count * i / workers;
+    queues[i].tail = count * (i + 1) / workers;
+  }
+
+  uint64_t start = SDL_GetPerformanceCounter();
+
+  for (int i = 0; i < workers && pool && threads; i++) {
+    pool[i].job = &job;
+    pool[i].id = i;
+    threads[i] = SDL_CreateThread(batch_worker, "batch", &pool[i]);
+    if (!threads[i])
+      batch_worker(&pool[i]);
+  }
+
+  size_t done = 0, failed = 0, bytes_in = 0, bytes_out = 0;
+  for (int i = 0; i < workers && pool && threads; i++) {
+    if (threads[i])
+      SDL_WaitThread(threads[i], NULL);
+    done += pool[i].files;
+    failed += pool[i].failed;
+    bytes_in += pool[i].bytes_in;
+    bytes_out += pool[i].bytes_out;
+  }
+
+  double seconds = (double)(SDL_GetPerformanceCounter() - start) /
+                   SDL_GetPerformanceFrequency();
+  if (seconds <= 0)
+    seconds = 1e-9;
+  double mb_in = bytes_in / (1024.0 * 1024.0);
+  double mb_out = bytes_out / (1024.0 * 1024.0);
+
+  printf("batch: %zu files (%zu failed) on %d threads in %.3f s\n", done,
+         failed, workers, seconds);
+  printf("batch: %.1f files/s; read %.1f MB (%.1f MB/s), wrote %.1f MB "
+         "(%.1f MB/s)\n",
+         done / seconds, mb_in, mb_in / seconds, mb_out, mb_out / seconds);
+
+  for (int i = 0; i < workers && queues; i++)
+    SDL_DestroyMutex(queues[i].lock);
+  for (size_t i = 0; i < count; i++)
+    free(files[i]);
+  free(files);
+  free(threads);
+  free(pool);
+  free(queues);
+  batch_script_free(&script);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,476 @@
+#include "../include/bracket_tree.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BRACKET_BLOCK_MAX (2 * BRACKET_BLOCK_SIZE)
+
+// Kind of bracket `c` is, with +1 for openers and -1 for closers.
+static int bracket_kind(char c, int *dir) {
+  switch (c) {
+  case '(':
+    *dir = 1;
+    return 0;
+  case ')':
+    *dir = -1;
+    return 0;
+  case '[':
+    *dir = 1;
+    return 1;
+  case ']':
+    *dir = -1;
+    return 1;
+  case '{':
+    *dir = 1;
+    return 2;
+  case '}':
+    *dir = -1;
+    return 2;
+  default:
+    *dir = 0;
+    return -1;
+  }
+}
+
+static void summary_combine(bracket_summary_t *out, const bracket_summary_t *a,
+                            const bracket_summary_t *b) {
+  bracket_summary_t r;
+  r.len = a->len + b->len;
+  for (int k = 0; k < BRACKET_KINDS; k++) {
+    int64_t right = a->net[k] + b->min_prefix[k];
+    r.net[k] = a->net[k] + b->net[k];
+    r.min_prefix[k] = a->min_prefix[k] < right ? a->min_prefix[k] : right;
+  }
+  *out = r;
+}
+
+static void summary_scan(bracket_summary_t *s, const char *text, size_t len) {
+  memset(s, 0, sizeof(*s));
+  s->len = len;
+  for (size_t i = 0; i < len; i++) {
+    int dir;
+    int k = bracket_kind(text[i], &dir);
+    if (k < 0)
+      continue;
+    s->net[k] += dir;
+    if (s->net[k] < s->min_prefix[k])
+      s->min_prefix[k] = s->net[k];
+  }
+}
+
+// Summarise [start, start + len) of the buffer in scratch-sized pieces.
+static void scan_range(bracket_tree_t *t, bracket_summary_t *out, size_t start,
+                       size_t len) {
+  memset(out, 0, sizeof(*out));
+  while (len > 0) {
+    size_t n = gap_copy_range(t->editor->buffer, start, BRACKET_BLOCK_MAX,
+                              t->scratch);
+    if (n > len)
+      n = len;
+    if (n == 0)
+      break;
+    bracket_summary_t piece;
+    summary_scan(&piece, t->scratch, n);
+    summary_combine(out, out, &piece);
+    start += n;
+    len -= n;
+  }
+}
+
+static bracket_summary_t *leaf_at(bracket_tree_t *t, size_t leaf) {
+  return &t->nodes[t->leaf_cap + leaf];
+}
+
+static void combine_node(bracket_tree_t *t, size_t node) {
+  summary_combine(&t->nodes[node], &t->nodes[2 * node],
+                  &t->nodes[2 * node + 1]);
+}
+
+static void pull_up(bracket_tree_t *t, size_t leaf) {
+  for (size_t node = (t->leaf_cap + leaf) / 2; node >= 1; node /= 2)
+    combine_node(t, node);
+}
+
+static void rebuild_internal(bracket_tree_t *t) {
+  for (size_t node = t->leaf_cap - 1; node >= 1; node--)
+    combine_node(t, node);
+}
+
+// Recompute the nodes of the aligned subtree over leaves [first, first +
+// count), then the ancestors above it.
+static void pull_up_window(bracket_tree_t *t, size_t first, size_t count) {
+  size_t lo = t->leaf_cap + first, hi = lo + count;
+  while (hi - lo > 1) {
+    lo /= 2;
+    hi /= 2;
+    for (size_t node = lo; node < hi; node++)
+      combine_node(t, node);
+  }
+  for (size_t node = lo / 2; node >= 1; node /= 2)
+    combine_node(t, node);
+}
+
+// Lay `n` block summaries out evenly over the leaves [first, first + count).
+// The empty leaves left between them are room for later splits.
+static void spread(bracket_tree_t *t, size_t first, size_t count,
+                   const bracket_summary_t *blocks, size_t n) {
+  memset(leaf_at(t, first), 0, count * sizeof(bracket_summary_t));
+  for (size_t i = 0; i < n; i++)
+    *leaf_at(t, first + i * count / n) = blocks[i];
+}
+
+static void tree_rebuild(bracket_tree_t *t) {
+  size_t len = t->editor->lines.length;
+  size_t count = (len + BRACKET_BLOCK_SIZE - 1) / BRACKET_BLOCK_SIZE;
+  if (count == 0)
+    count = 1;
+
+  // Half the leaves start out empty
+  size_t cap = 1;
+  while (cap < 2 * count)
+    cap *= 2;
+
+  free(t->nodes);
+  t->leaf_cap = 0;
+  t->block_count = 0;
+  t->nodes = calloc(2 * cap, sizeof(bracket_summary_t));
+  if (!t->nodes) {
+    fprintf(stderr, "Could not build bracket tree of %zu blocks.\n", cap);
+    return;
+  }
+  t->leaf_cap = cap;
+  t->block_count = count;
+
+  for (size_t i = 0; i < count; i++) {
+    size_t start = i * BRACKET_BLOCK_SIZE;
+    size_t n = len - start < BRACKET_BLOCK_SIZE ? len - start
+                                                : BRACKET_BLOCK_SIZE;
+    scan_range(t, leaf_at(t, i * cap / count), start, start < len ? n : 0);
+  }
+  rebuild_internal(t);
+}
+
+// Split the oversized block at `leaf`, which starts at byte `start`, into
+// BRACKET_BLOCK_SIZE pieces. As in a packed-memory array, the pieces are
+// spread over the smallest aligned subtree around the leaf that stays under
+// its density limit, and only that subtree and its ancestors are
+// recomputed. The limit runs from full for a pair of leaves down to half
+// for the root; a root over it doubles the tree. Returns false, with the
+// tree untouched, when memory runs out.
+static bool split_leaf(bracket_tree_t *t, size_t leaf, size_t start) {
+  size_t len = leaf_at(t, leaf)->len;
+  size_t pieces = (len + BRACKET_BLOCK_SIZE - 1) / BRACKET_BLOCK_SIZE;
+
+  size_t height = 0;
+  while (((size_t)1 << height) < t->leaf_cap)
+    height++;
+
+  // Widen the window one level at a time, counting the blocks in each half
+  // as it is added
+  size_t first = leaf, count = 1, used = 1;
+  bool fits = false;
+  for (size_t h = 1; h <= height && !fits; h++) {
+    size_t wider = (leaf >> h) << h;
+    size_t other = wider == first ? first + count : wider;
+    for (size_t i = other; i < other + count; i++)
+      used += leaf_at(t, i)->len > 0;
+    first = wider;
+    count *= 2;
+    fits = used - 1 + pieces <= count - count * h / (2 * height);
+  }
+
+  size_t n = used - 1 + pieces;
+  bracket_summary_t *blocks = malloc(n * sizeof(bracket_summary_t));
+  bracket_summary_t *nodes = NULL;
+  size_t cap = t->leaf_cap;
+  if (!fits) {
+    while (n > cap / 2)
+      cap *= 2;
+    nodes = calloc(2 * cap, sizeof(bracket_summary_t));
+  }
+  if (!blocks || (!fits && !nodes)) {
+    fprintf(stderr, "Could not split bracket block of %zu bytes.\n", len);
+    free(blocks);
+    free(nodes);
+    return false;
+  }
+
+  size_t k = 0;
+  for (size_t i = first; i < first + count; i++) {
+    if (i != leaf) {
+      if (leaf_at(t, i)->len > 0)
+        blocks[k++] = *leaf_at(t, i);
+      continue;
+    }
+    for (size_t p = 0; p < pieces; p++) {
+      size_t piece = len < BRACKET_BLOCK_SIZE ? len : BRACKET_BLOCK_SIZE;
+      scan_range(t, &blocks[k++], start, piece);
+      start += piece;
+      len -= piece;
+    }
+  }
+
+  if (fits) {
+    spread(t, first, count, blocks, n);
+    pull_up_window(t, first, count);
+  } else {
+    free(t->nodes);
+    t->nodes = nodes;
+    t->leaf_cap = cap;
+    spread(t, 0, cap, blocks, n);
+    rebuild_internal(t);
+  }
+  t->block_count += pieces - 1;
+
+  free(blocks);
+  return true;
+}
+
+// Leaf holding byte `pos`. With `at_end`, a position on a block boundary
+// resolves to the block that ends there, which is where an insert goes.
+// Empty leaves are skipped over.
+static size_t find_leaf(const bracket_tree_t *t, size_t pos, bool at_end) {
+  size_t node = 1, start = 0;
+  while (node < t->leaf_cap) {
+    size_t left_len = t->nodes[2 * node].len;
+    if (pos < start + left_len ||
+        (at_end && left_len > 0 && pos == start + left_len)) {
+      node = 2 * node;
+    } else {
+      start += left_len;
+      node = 2 * node + 1;
+    }
+  }
+  return node - t->leaf_cap;
+}
+
+static size_t leaf_start(const bracket_tree_t *t, size_t leaf) {
+  size_t start = 0;
+  for (size_t node = t->leaf_cap + leaf; node > 1; node /= 2) {
+    if (node & 1)
+      start += t->nodes[node - 1].len;
+  }
+  return start;
+}
+
+// Called with the editor lock held, right after each edit. Costs the bytes
+// the edit touched plus O(log n) per block, whatever the edit's size.
+static void bracket_tree_on_change(void *ctx, const editor_change_t *change) {
+  bracket_tree_t *t = ctx;
+
+  // Nothing to patch: the text was replaced as a whole, or the last build
+  // ran out of memory
+  if (!t->nodes || change->removed >= t->nodes[1].len) {
+    tree_rebuild(t);
+    return;
+  }
+
+  size_t first = t->leaf_cap, last = 0;
+
+  // Shrink the blocks that lost bytes
+  if (change->removed) {
+    size_t leaf = find_leaf(t, change->pos, false);
+    size_t offset = change->pos - leaf_start(t, leaf);
+    size_t remaining = change->removed;
+    first = leaf;
+    for (; remaining > 0 && leaf < t->leaf_cap; leaf++) {
+      bracket_summary_t *s = leaf_at(t, leaf);
+      size_t take = s->len - offset;
+      if (take > remaining)
+        take = remaining;
+      if (take > 0 && take == s->len)
+        t->block_count--;
+      s->len -= take;
+      remaining -= take;
+      offset = 0;
+      last = leaf;
+      pull_up(t, leaf);
+    }
+  }
+
+  // Grow the block the new bytes landed in
+  if (change->inserted) {
+    size_t leaf = find_leaf(t, change->pos, true);
+    if (leaf_at(t, leaf)->len == 0)
+      t->block_count++;
+    leaf_at(t, leaf)->len += change->inserted;
+    if (leaf < first)
+      first = leaf;
+    if (leaf > last)
+      last = leaf;
+  }
+
+  if (first > last)
+    return;
+
+  // Rescan the touched blocks; one that grew too large is split after
+  size_t start = leaf_start(t, first);
+  size_t big = t->leaf_cap, big_start = 0;
+  for (size_t leaf = first; leaf <= last; leaf++) {
+    size_t len = leaf_at(t, leaf)->len;
+    if (len > BRACKET_BLOCK_MAX && big == t->leaf_cap) {
+      big = leaf;
+      big_start = start;
+    } else {
+      scan_range(t, leaf_at(t, leaf), start, len);
+      pull_up(t, leaf);
+    }
+    start += len;
+  }
+  if (big < t->leaf_cap && !split_leaf(t, big, big_start)) {
+    // Keep it as one large block; searches read it in pieces
+    scan_range(t, leaf_at(t, big), big_start, leaf_at(t, big)->len);
+    pull_up(t, big);
+  }
+
+  // Deletes leave small and empty blocks behind; compact once the tree is
+  // mostly slack
+  size_t wanted = t->nodes[1].len / BRACKET_BLOCK_SIZE + 1;
+  if ((t->block_count > 64 && t->block_count > 4 * wanted) ||
+      (t->leaf_cap > 64 && t->leaf_cap > 8 * t->block_count))
+    tree_rebuild(t);
+}
+
+bracket_tree_t *bracket_tree_create(editor_t *editor) {
+  bracket_tree_t *t = calloc(1, sizeof(bracket_tree_t));
+  if (!t)
+    return NULL;
+
+  t->editor = editor;
+  t->scratch = malloc(BRACKET_BLOCK_MAX);
+  if (!t->scratch) {
+    free(t);
+    return NULL;
+  }
+
+  editor_lock(editor);
+  tree_rebuild(t);
+  editor_add_listener(editor, bracket_tree_on_change, t);
+  editor_unlock(editor);
+
+  return t;
+}
+
+void bracket_tree_destroy(bracket_tree_t *t) {
+  if (!t)
+    return;
+
+  editor_lock(t->editor);
+  editor_remove_listener(t->editor, bracket_tree_on_change, t);
+  editor_unlock(t->editor);
+
+  free(t->nodes);
+  free(t->scratch);
+  free(t);
+}
+
+// First closer at or after `from` that takes the running depth to -1.
+static bool find_close(bracket_tree_t *t, size_t node, size_t start,
+                       size_t from, int kind, int64_t *depth, size_t *out) {
+  const bracket_summary_t *s = &t->nodes[node];
+  size_t end = start + s->len;
+
+  if (s->len == 0 || end <= from)
+    return false;
+  if (start >= from && *depth + s->min_prefix[kind] > -1) {
+    *depth += s->net[kind];
+    return false;
+  }
+
+  if (node >= t->leaf_cap) {
+    size_t pos = start > from ? start : from;
+    while (pos < end) {
+      size_t n = end - pos < BRACKET_BLOCK_MAX ? end - pos : BRACKET_BLOCK_MAX;
+      n = gap_copy_range(t->editor->buffer, pos, n, t->scratch);
+      if (n == 0)
+        break;
+      for (size_t i = 0; i < n; i++) {
+        int dir;
+        if (bracket_kind(t->scratch[i], &dir) != kind)
+          continue;
+        *depth += dir;
+        if (*depth == -1) {
+          *out = pos + i;
+          return true;
+        }
+      }
+      pos += n;
+    }
+    return false;
+  }
+
+  if (find_close(t, 2 * node, start, from, kind, depth, out))
+    return true;
+  return find_close(t, 2 * node + 1, start + t->nodes[2 * node].len, from,
+                    kind, depth, out);
+}
+
+// Last opener before `before` that takes the running depth to +1, reading
+// right to left.
+static bool find_open(bracket_tree_t *t, size_t node, size_t start,
+                      size_t before, int kind, int64_t *depth, size_t *out) {
+  const bracket_summary_t *s = &t->nodes[node];
+  size_t end = start + s->len;
+
+  if (s->len == 0 || start >= before)
+    return false;
+  if (end <= before && *depth + s->net[kind] - s->min_prefix[kind] < 1) {
+    *depth += s->net[kind];
+    return false;
+  }
+
+  if (node >= t->leaf_cap) {
+    size_t stop = end < before ? end : before;
+    while (stop > start) {
+      size_t n = stop - start < BRACKET_BLOCK_MAX ? stop - start
+                                                  : BRACKET_BLOCK_MAX;
+      gap_copy_range(t->editor->buffer, stop - n, n, t->scratch);
+      for (size_t i = n; i-- > 0;) {
+        int dir;
+        if (bracket_kind(t->scratch[i], &dir) != kind)
+          continue;
+        *depth += dir;
+        if (*depth == 1) {
+          *out = stop - n + i;
+          return true;
+        }
+      }
+      stop -= n;
+    }
+    return false;
+  }
+
+  if (find_open(t, 2 * node + 1, start + t->nodes[2 * node].len, before, kind,
+                depth, out))
+    return true;
+  return find_open(t, 2 * node, start, before, kind, depth, out);
+}
+
+// Partner of the bracket at `pos`, found by descending the tree.
+bool bracket_tree_match(bracket_tree_t *t, size_t pos, size_t *match) {
+  int dir;
+  if (!t->nodes)
+    return false;
+  int kind = bracket_kind(gap_char_at(t->editor->buffer, pos), &dir);
+  if (kind < 0 || pos >= t->nodes[1].len)
+    return false;
+
+  int64_t depth = 0;
+  if (dir > 0)
+    return find_close(t, 1, 0, pos + 1, kind, &depth, match);
+  return find_open(t, 1, 0, pos, kind, &depth, match);
+}
+
+// Match the bracket after the caret at `pos`, or else the one before it.
+bool bracket_tree_match_near(bracket_tree_t *t, size_t pos, size_t *bracket,
+                             size_t *match) {
+  if (bracket_tree_match(t, pos, match)) {
+    *bracket = pos;
+    return true;
+  }
+  if (pos > 0 && bracket_tree_match(t, pos - 1, match)) {
+    *bracket = pos - 1;
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,144 @@
+#include "../include/clipboard.h"
+#include "SDL_clipboard.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void clipboard_drop(clipboard_t *c) {
+  c->pending = false;
+  free(c->owned);
+  c->owned = NULL;
+}
+
+// Copy the pending range out of the buffer, so edits no longer touch it.
+static bool clipboard_take(clipboard_t *c) {
+  if (!c->pending || c->owned)
+    return true;
+  char *bytes = malloc(c->len ? c->len : 1);
+  if (!bytes)
+    return false;
+  gap_copy_range(c->editor->buffer, c->pos, c->len, bytes);
+  c->owned = bytes;
+  return true;
+}
+
+// Keep the pending range on the same text, or take its bytes while they are
+// still intact if the edit is about to change them.
+static void clipboard_on_edit(void *ctx, const editor_change_t *change) {
+  clipboard_t *c = ctx;
+  if (!c->pending || c->owned)
+    return;
+
+  size_t end = c->pos + c->len;
+  if (change->pos >= end)
+    return;
+
+  if (change->pos + change->removed <= c->pos) {
+    c->pos = c->pos - change->removed + change->inserted;
+    return;
+  }
+  if (!clipboard_take(c)) {
+    fprintf(stderr, "Could not keep %zu copied bytes.\n", c->len);
+    clipboard_drop(c);
+  }
+}
+
+clipboard_t *clipboard_create(editor_t *editor) {
+  clipboard_t *c = calloc(1, sizeof(clipboard_t));
+  if (!c) {
+    fprintf(stderr, "Could not create clipboard.\n");
+    return NULL;
+  }
+  c->editor = editor;
+  if (!editor_add_before_listener(editor, clipboard_on_edit, c)) {
+    fprintf(stderr, "Could not attach clipboard to editor.\n");
+    free(c);
+    return NULL;
+  }
+  return c;
+}
+
+// Publishes a pending copy first so it survives the editor.
+void clipboard_destroy(clipboard_t *c) {
+  if (!c)
+    return;
+  clipboard_publish(c);
+  editor_remove_listener(c->editor, clipboard_on_edit, c);
+  free(c);
+}
+
+// Hand the pending copy to the system clipboard as a string.
+void clipboard_publish(clipboard_t *c) {
+  if (!c->pending)
+    return;
+
+  char *text = c->owned ? realloc(c->owned, c->len + 1) : malloc(c->len + 1);
+  if (!text) {
+    fprintf(stderr, "Could not copy %zu bytes to the clipboard.\n", c->len);
+    clipboard_drop(c);
+    return;
+  }
+  if (!c->owned)
+    gap_copy_range(c->editor->buffer, c->pos, c->len, text);
+  c->owned = text;
+  text[c->len] = '\0';
+  if (SDL_SetClipboardText(text) != 0)
+    fprintf(stderr, "Could not set clipboard: %s\n", SDL_GetError());
+  clipboard_drop(c);
+}
+
+// Another application took over the clipboard; our copy is stale.
+void clipboard_forget(clipboard_t *c) { clipboard_drop(c); }
+
+// Record [pos, pos + len) as the clipboard contents. Small copies are
+// published at once; large ones stay a range until something needs them.
+void clipboard_copy(clipboard_t *c, size_t pos, size_t len) {
+  clipboard_drop(c);
+  c->pending = true;
+  c->pos = pos;
+  c->len = len;
+  if (len <= CLIPBOARD_EAGER_LIMIT)
+    clipboard_publish(c);
+}
+
+bool clipboard_copy_selection(clipboard_t *c) {
+  size_t start, end;
+  if (!editor_get_selection(c->editor, &start, &end))
+    return false;
+  clipboard_copy(c, start, end - start);
+  return true;
+}
+
+// The cut text is taken out of the buffer before it is deleted. Without
+// memory for that the selection stays, as a copy.
+bool clipboard_cut_selection(clipboard_t *c) {
+  if (!clipboard_copy_selection(c))
+    return false;
+  if (!clipboard_take(c)) {
+    fprintf(stderr, "Could not cut %zu bytes.\n", c->len);
+    return false;
+  }
+  return editor_delete_selection(c->editor);
+}
+
+// Insert the clipboard at the caret, replacing the selection. A pending
+// copy is inserted from the buffer or the clipboard's own bytes and never
+// becomes a string.
+bool clipboard_paste(clipboard_t *c) {
+  editor_delete_selection(c->editor);
+
+  if (c->pending) {
+    if (c->owned)
+      return editor_insert_text(c->editor, c->owned, c->len);
+    return editor_insert_range(c->editor, c->pos, c->len);
+  }
+
+  if (!SDL_HasClipboardText())
+    return false;
+  char *text = SDL_GetClipboardText();
+  if (!text)
+    return false;
+  bool ok = editor_insert_text(c->editor, text, strlen(text));
+  SDL_free(text);
+  return ok;
+}
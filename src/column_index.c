@@ -0,0 +1,302 @@
+#include "../include/column_index.h"
+#include "../include/utf8.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COLUMN_WALK_CHUNK 4096
+
+// Walk the characters in [from, to), adding their columns to *col. Stops
+// early at the start of the character that would begin column `stop_col`.
+// Returns the position it stopped at.
+static size_t walk(const column_index_t *ci, size_t from, size_t to,
+                   size_t *col, size_t stop_col) {
+  char buf[COLUMN_WALK_CHUNK];
+  size_t pos = from;
+
+  while (pos < to) {
+    size_t want = to - pos;
+    if (want > COLUMN_WALK_CHUNK)
+      want = COLUMN_WALK_CHUNK;
+    size_t n = gap_copy_range(ci->buffer, pos, want, buf);
+
+    size_t i = 0;
+    while (i < n) {
+      // A character cut off by the chunk is re-read with the next one
+      if (n - i < UTF8_MAX_BYTES && pos + n < to)
+        break;
+
+      uint32_t cp;
+      size_t len = utf8_decode(buf + i, n - i, &cp);
+      if (!utf8_is_combining(cp)) {
+        if (*col == stop_col)
+          return pos + i;
+        (*col)++;
+      }
+      i += len;
+    }
+    pos += i;
+  }
+
+  return pos;
+}
+
+static bool push_checkpoint(column_line_t *cl, size_t at, size_t byte,
+                            size_t col) {
+  if (cl->count == cl->capacity) {
+    size_t cap = cl->capacity ? cl->capacity * 2 : 8;
+    column_checkpoint_t *cps = realloc(cl->cps, cap * sizeof(*cps));
+    if (!cps)
+      return false;
+    cl->cps = cps;
+    cl->capacity = cap;
+  }
+  memmove(cl->cps + at + 1, cl->cps + at, (cl->count - at) * sizeof(*cl->cps));
+  cl->cps[at].byte = byte;
+  cl->cps[at].col = col;
+  cl->count++;
+  return true;
+}
+
+// Add checkpoints between cps[at] and the absolute position `end` every
+// COLUMN_CHECKPOINT columns. Returns the column reached at `end`.
+static size_t fill_checkpoints(const column_index_t *ci, column_line_t *cl,
+                               size_t line_start, size_t at, size_t end) {
+  size_t pos = line_start + cl->cps[at].byte;
+  size_t col = cl->cps[at].col;
+
+  for (;;) {
+    size_t next = walk(ci, pos, end, &col, col + COLUMN_CHECKPOINT);
+    if (next >= end)
+      return col;
+    if (!push_checkpoint(cl, ++at, next - line_start, col)) {
+      walk(ci, next, end, &col, SIZE_MAX);
+      return col;
+    }
+    pos = next;
+  }
+}
+
+static void build_line(column_index_t *ci, column_line_t *cl, size_t line) {
+  size_t start = line_index_line_start(ci->lines, line);
+  size_t len = line_index_line_length(ci->lines, line);
+  char buf[COLUMN_WALK_CHUNK];
+
+  cl->valid = true;
+  cl->line = line;
+  cl->bytes = len;
+  cl->count = 0;
+
+  cl->ascii = true;
+  for (size_t off = 0; off < len && cl->ascii; off += COLUMN_WALK_CHUNK) {
+    size_t n = gap_copy_range(ci->buffer, start + off, COLUMN_WALK_CHUNK, buf);
+    if (n > len - off)
+      n = len - off;
+    for (size_t i = 0; i < n; i++) {
+      if (buf[i] & 0x80) {
+        cl->ascii = false;
+        break;
+      }
+    }
+  }
+
+  if (cl->ascii) {
+    cl->columns = len;
+    return;
+  }
+
+  if (!push_checkpoint(cl, 0, 0, 0)) {
+    cl->valid = false;
+    return;
+  }
+  cl->columns = fill_checkpoints(ci, cl, start, 0, start + len);
+}
+
+static column_line_t *lookup(column_index_t *ci, size_t line) {
+  column_line_t *cl = &ci->slots[line % COLUMN_INDEX_SLOTS];
+  if (!cl->valid || cl->line != line)
+    build_line(ci, cl, line);
+  return cl;
+}
+
+// Index of the last checkpoint at or before byte `byte`.
+static size_t checkpoint_by_byte(const column_line_t *cl, size_t byte) {
+  size_t lo = 0, hi = cl->count;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (cl->cps[mid].byte <= byte)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Index of the last checkpoint at or before column `col`.
+static size_t checkpoint_by_col(const column_line_t *cl, size_t col) {
+  size_t lo = 0, hi = cl->count;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (cl->cps[mid].col <= col)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+void column_index_init(column_index_t *ci, const gap_buffer_t *g,
+                       const line_index_t *li) {
+  memset(ci, 0, sizeof(*ci));
+  ci->buffer = g;
+  ci->lines = li;
+}
+
+void column_index_free(column_index_t *ci) {
+  for (int i = 0; i < COLUMN_INDEX_SLOTS; i++) {
+    free(ci->slots[i].cps);
+    ci->slots[i].cps = NULL;
+    ci->slots[i].valid = false;
+  }
+}
+
+// Patch a cached line after an edit that stayed inside it: checkpoints
+// behind the edit shift, and only the segment around it is re-counted.
+static void patch_line(column_index_t *ci, column_line_t *cl, size_t start,
+                       size_t b, size_t removed, size_t inserted) {
+  if (cl->ascii) {
+    char buf[COLUMN_WALK_CHUNK];
+    for (size_t off = 0; off < inserted; off += COLUMN_WALK_CHUNK) {
+      size_t n = gap_copy_range(ci->buffer, start + b + off,
+                                COLUMN_WALK_CHUNK, buf);
+      if (n > inserted - off)
+        n = inserted - off;
+      for (size_t i = 0; i < n; i++) {
+        if (buf[i] & 0x80) {
+          cl->valid = false;
+          return;
+        }
+      }
+    }
+    cl->bytes = cl->bytes - removed + inserted;
+    cl->columns = cl->bytes;
+    return;
+  }
+
+  size_t i = checkpoint_by_byte(cl, b);
+  size_t j = i + 1;
+  while (j < cl->count && cl->cps[j].byte < b + removed)
+    j++;
+
+  // Checkpoints inside the removed bytes are gone
+  memmove(cl->cps + i + 1, cl->cps + j, (cl->count - j) * sizeof(*cl->cps));
+  cl->count -= j - i - 1;
+  j = i + 1;
+
+  cl->bytes = cl->bytes - removed + inserted;
+  size_t seg_end = j < cl->count ? cl->cps[j].byte - removed + inserted
+                                 : cl->bytes;
+
+  size_t old_col = j < cl->count ? cl->cps[j].col : cl->columns;
+  size_t count_before = cl->count;
+  size_t new_col = fill_checkpoints(ci, cl, start, i, start + seg_end);
+  j += cl->count - count_before;
+
+  for (size_t k = j; k < cl->count; k++) {
+    cl->cps[k].byte = cl->cps[k].byte - removed + inserted;
+    cl->cps[k].col = cl->cps[k].col - old_col + new_col;
+  }
+  cl->columns = cl->columns - old_col + new_col;
+}
+
+// After an edit replaced the old lines [first, old_end): drop those, and
+// renumber the cached lines below them by `delta`. A renumbered line moves
+// to its new slot by swapping, so each checkpoint array stays with its line;
+// when the slot already holds a line that kept its place, that one wins.
+static void shift_lines(column_index_t *ci, size_t first, size_t old_end,
+                        long delta) {
+  for (int i = 0; i < COLUMN_INDEX_SLOTS; i++) {
+    column_line_t *cl = &ci->slots[i];
+    if (!cl->valid || cl->line < first)
+      continue;
+    if (cl->line < old_end)
+      cl->valid = false;
+    else
+      cl->line += delta;
+  }
+  if (delta % COLUMN_INDEX_SLOTS == 0)
+    return;
+
+  for (int i = 0; i < COLUMN_INDEX_SLOTS; i++) {
+    column_line_t *cl = &ci->slots[i];
+    while (cl->valid && cl->line % COLUMN_INDEX_SLOTS != (size_t)i) {
+      column_line_t *to = &ci->slots[cl->line % COLUMN_INDEX_SLOTS];
+      if (to->valid && to->line % COLUMN_INDEX_SLOTS ==
+                           cl->line % COLUMN_INDEX_SLOTS) {
+        cl->valid = false;
+        break;
+      }
+      column_line_t tmp = *to;
+      *to = *cl;
+      *cl = tmp;
+    }
+  }
+}
+
+void column_index_update(column_index_t *ci, size_t pos, size_t removed,
+                         size_t inserted, size_t first_line, long line_delta) {
+  size_t last_line = line_index_line_of(ci->lines, pos + inserted);
+
+  if (line_delta != 0 || last_line != first_line) {
+    // Lines were split or joined: only the ones the edit touched are dropped
+    shift_lines(ci, first_line, last_line + 1 - line_delta, line_delta);
+    return;
+  }
+
+  column_line_t *cl = &ci->slots[first_line % COLUMN_INDEX_SLOTS];
+  if (!cl->valid || cl->line != first_line)
+    return;
+
+  size_t start = line_index_line_start(ci->lines, first_line);
+  patch_line(ci, cl, start, pos - start, removed, inserted);
+}
+
+size_t column_index_col_of(column_index_t *ci, size_t line, size_t byte) {
+  column_line_t *cl = lookup(ci, line);
+  if (!cl->valid)
+    return byte;
+  if (byte > cl->bytes)
+    byte = cl->bytes;
+  if (cl->ascii)
+    return byte;
+
+  size_t start = line_index_line_start(ci->lines, line);
+  size_t k = checkpoint_by_byte(cl, byte);
+  size_t col = cl->cps[k].col;
+  walk(ci, start + cl->cps[k].byte, start + byte, &col, SIZE_MAX);
+  return col;
+}
+
+size_t column_index_byte_of(column_index_t *ci, size_t line, size_t col) {
+  column_line_t *cl = lookup(ci, line);
+  if (!cl->valid)
+    return col;
+  if (col >= cl->columns)
+    return cl->bytes;
+  if (cl->ascii)
+    return col;
+
+  size_t start = line_index_line_start(ci->lines, line);
+  size_t k = checkpoint_by_col(cl, col);
+  size_t c = cl->cps[k].col;
+  return walk(ci, start + cl->cps[k].byte, start + cl->bytes, &c, col) -
+         start;
+}
+
+size_t column_index_columns(column_index_t *ci, size_t line) {
+  column_line_t *cl = lookup(ci, line);
+  if (!cl->valid)
+    return line_index_line_length(ci->lines, line);
+  return cl->columns;
+}
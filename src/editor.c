@@ -1,9 +1,23 @@
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
 #include "../include/editor.h"
 #include "../include/gap_buffer.h"
+#include "../include/utf8.h"
 #include "SDL_timer.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
 
 editor_t *editor_create(size_t inital_capacity) {
   editor_t *e = malloc(sizeof(editor_t));
@@ -13,6 +27,20 @@ editor_t *editor_create(size_t inital_capacity) {
   e->state = RUNNING;
 
   e->buffer = gap_create(inital_capacity);
+  line_index_init(&e->lines);
+  column_index_init(&e->columns, e->buffer, &e->lines);
+
+  e->path = NULL;
+  e->dirty = false;
+  e->syncing = false;
+
+  e->lock = SDL_CreateMutex();
+  e->listener_count = 0;
+  e->before_listener_count = 0;
+
+  e->selecting = false;
+  e->anchor = 0;
+  e->head = 0;
 
   e->cursor_line = 0;
   e->cursor_col = 0;
@@ -30,20 +58,171 @@ void editor_destory(editor_t *editor) {
   if (!editor)
     return;
   gap_destroy(editor->buffer);
+  line_index_free(&editor->lines);
+  column_index_free(&editor->columns);
+  free(editor->path);
+  SDL_DestroyMutex(editor->lock);
   free(editor);
 }
 
+void editor_lock(editor_t *editor) { SDL_LockMutex(editor->lock); }
+
+void editor_unlock(editor_t *editor) { SDL_UnlockMutex(editor->lock); }
+
+bool editor_add_listener(editor_t *editor, editor_listener_fn fn, void *ctx) {
+  if (editor->listener_count >= EDITOR_MAX_LISTENERS)
+    return false;
+  editor->listeners[editor->listener_count].fn = fn;
+  editor->listeners[editor->listener_count].ctx = ctx;
+  editor->listener_count++;
+  return true;
+}
+
+bool editor_add_before_listener(editor_t *editor, editor_listener_fn fn,
+                                void *ctx) {
+  if (editor->before_listener_count >= EDITOR_MAX_LISTENERS)
+    return false;
+  editor->before_listeners[editor->before_listener_count].fn = fn;
+  editor->before_listeners[editor->before_listener_count].ctx = ctx;
+  editor->before_listener_count++;
+  return true;
+}
+
+void editor_remove_listener(editor_t *editor, editor_listener_fn fn,
+                            void *ctx) {
+  for (int i = 0; i < editor->listener_count; i++) {
+    if (editor->listeners[i].fn == fn && editor->listeners[i].ctx == ctx) {
+      editor->listeners[i] = editor->listeners[--editor->listener_count];
+      break;
+    }
+  }
+  for (int i = 0; i < editor->before_listener_count; i++) {
+    if (editor->before_listeners[i].fn == fn &&
+        editor->before_listeners[i].ctx == ctx) {
+      editor->before_listeners[i] =
+          editor->before_listeners[--editor->before_listener_count];
+      break;
+    }
+  }
+}
+
+static void editor_prepare(editor_t *editor, size_t pos, size_t removed,
+                           size_t inserted) {
+  editor_change_t change = {
+      .pos = pos,
+      .removed = removed,
+      .inserted = inserted,
+      .first_line = line_index_line_of(&editor->lines, pos),
+      .line_delta = 0,
+  };
+  for (int i = 0; i < editor->before_listener_count; i++)
+    editor->before_listeners[i].fn(editor->before_listeners[i].ctx, &change);
+}
+
+// Where offset `at` ends up after [pos, pos + removed) became `inserted` bytes
+static size_t editor_map_offset(size_t at, size_t pos, size_t removed,
+                                size_t inserted) {
+  if (at >= pos + removed)
+    return at - removed + inserted;
+  if (at > pos)
+    return pos;
+  return at;
+}
+
+static void editor_notify(editor_t *editor, size_t pos, size_t removed,
+                          size_t inserted, size_t old_line_count) {
+  editor_change_t change = {
+      .pos = pos,
+      .removed = removed,
+      .inserted = inserted,
+      .first_line = line_index_line_of(&editor->lines, pos),
+      .line_delta = (long)editor->lines.count - (long)old_line_count,
+  };
+  column_index_update(&editor->columns, pos, removed, inserted,
+                      change.first_line, change.line_delta);
+  if (editor->selecting) {
+    editor->anchor = editor_map_offset(editor->anchor, pos, removed, inserted);
+    editor->head = editor_map_offset(editor->head, pos, removed, inserted);
+  }
+  for (int i = 0; i < editor->listener_count; i++)
+    editor->listeners[i].fn(editor->listeners[i].ctx, &change);
+}
+
+// An edit the before listeners were told about but that could not be made
+// is reported to the after listeners as an empty one, keeping them paired.
+static void editor_abort(editor_t *editor, size_t pos) {
+  fprintf(stderr, "Out of memory; the edit was not made.\n");
+  editor_notify(editor, pos, 0, 0, editor->lines.count);
+}
+
 void editor_insert_char(editor_t *editor, const char c) {
+  editor_insert_text(editor, &c, 1);
+}
+
+// Insert a run of UTF-8 text at the caret as a single edit, replacing the
+// selection if there is one. Returns false, with the text unchanged, when
+// there is no memory for it.
+bool editor_insert_text(editor_t *editor, const char *text, size_t n) {
+  editor_delete_selection(editor);
+  if (n == 0)
+    return true;
   editor_cursor_recompute_ticks(editor);
+  if (!gap_reserve(editor->buffer, n))
+    return false;
+
+  size_t pos = editor->buffer->gap_start;
+  size_t old_lines = editor->lines.count;
+  editor_prepare(editor, pos, 0, n);
+  if (!line_index_insert(&editor->lines, pos, text, n)) {
+    editor_abort(editor, pos);
+    return false;
+  }
+  gap_insert_bytes(editor->buffer, text, n);
+  editor->dirty = true;
+  editor_notify(editor, pos, 0, n, old_lines);
+  editor_sync_cursor(editor);
+  return true;
+}
 
-  gap_insert_char(editor->buffer, c);
+// Insert a copy of the text at [src, src + n) at the caret. The bytes go
+// from the buffer straight into the gap with at most one expansion.
+bool editor_insert_range(editor_t *editor, size_t src, size_t n) {
+  if (n == 0)
+    return true;
+  editor_cursor_recompute_ticks(editor);
 
-  if (c == '\n') {
-    editor->cursor_line++;
-    editor->cursor_col = 0;
-  } else {
-    editor->cursor_col++;
+  gap_buffer_t *g = editor->buffer;
+  if (!gap_reserve(g, n))
+    return false;
+
+  size_t pos = g->gap_start;
+  size_t old_lines = editor->lines.count;
+  editor_prepare(editor, pos, 0, n);
+  gap_insert_range(g, src, n);
+  if (!line_index_insert(&editor->lines, pos, g->buffer + pos,
+                         g->gap_start - pos)) {
+    g->gap_start = pos;
+    editor_abort(editor, pos);
+    return false;
   }
+  editor->dirty = true;
+  editor_notify(editor, pos, 0, g->gap_start - pos, old_lines);
+  editor_sync_cursor(editor);
+  return true;
+}
+
+void editor_delete_range(editor_t *editor, size_t pos, size_t n) {
+  if (n == 0)
+    return;
+  editor_cursor_recompute_ticks(editor);
+
+  size_t old_lines = editor->lines.count;
+  editor_prepare(editor, pos, n, 0);
+  gap_delete_range(editor->buffer, pos, n);
+  line_index_delete(&editor->lines, pos, n);
+  editor->dirty = true;
+  editor_notify(editor, pos, n, 0, old_lines);
+  editor_sync_cursor(editor);
 }
 
 void editor_cursor_recompute_ticks(editor_t *editor) {
@@ -53,141 +232,430 @@ void editor_cursor_recompute_ticks(editor_t *editor) {
   }
 }
 
+// Delete the character before the caret together with its combining marks,
+// or the selection if there is one.
 void editor_backspace(editor_t *editor) {
-  editor_cursor_recompute_ticks(editor);
-  char deleted = gap_peek_before(editor->buffer);
+  if (editor_delete_selection(editor))
+    return;
 
-  if (deleted == 0)
+  size_t end = editor->buffer->gap_start;
+  if (end == 0)
     return;
+  size_t start = utf8_prev_grapheme(editor->buffer, end);
+  editor_delete_range(editor, start, end - start);
+}
 
-  gap_delete_char(editor->buffer);
+// Length of a line in display columns.
+int editor_get_line_length(editor_t *editor, int line_number) {
+  return column_index_columns(&editor->columns, line_number);
+}
 
-  if (deleted == '\n') {
-    editor->cursor_line--;
-    // Move cursor to end of previous line
-    editor->cursor_col = editor_get_line_length(editor, editor->cursor_line);
-  } else {
-    if (editor->cursor_col > 0) {
-      editor->cursor_col--;
-    }
-  }
+size_t editor_col_to_byte(editor_t *editor, int line_number, int col) {
+  return column_index_byte_of(&editor->columns, line_number, col);
 }
 
-int editor_get_line_length(editor_t *editor, int line_number) {
-  char *s = malloc(editor->buffer->capacity);
-  gap_to_string(editor->buffer, s);
+int editor_byte_to_col(editor_t *editor, int line_number, size_t byte) {
+  return column_index_col_of(&editor->columns, line_number, byte);
+}
 
-  int current = 0;
-  int len = 0;
+char *editor_get_line(editor_t *editor, int line_number) {
+  size_t start = line_index_line_start(&editor->lines, line_number);
+  size_t len = line_index_line_length(&editor->lines, line_number);
 
-  for (char *p = s; *p; p++) {
-    if (current == line_number) {
-      if (*p == '\n') {
-        break;
-      }
-      len++;
-    }
-    if (*p == '\n')
-      current++;
-  }
+  char *line = malloc(len + 1);
+  if (!line)
+    return NULL;
+  gap_copy_range(editor->buffer, start, len, line);
+  line[len] = '\0';
+  return line;
+}
+
+// Copy only the columns [first_col, first_col + max_cols) of a line, so
+// drawing a very long line costs what is on screen rather than its length.
+char *editor_get_line_columns(editor_t *editor, int line_number, int first_col,
+                              int max_cols) {
+  size_t start = line_index_line_start(&editor->lines, line_number);
+  size_t from = editor_col_to_byte(editor, line_number, first_col);
+  size_t to = editor_col_to_byte(editor, line_number, first_col + max_cols);
+
+  char *line = malloc(to - from + 1);
+  if (!line)
+    return NULL;
+  gap_copy_range(editor->buffer, start + from, to - from, line);
+  line[to - from] = '\0';
+  return line;
+}
 
-  free(s);
-  return len;
+// Recompute cursor_line/cursor_col from the caret position.
+void editor_sync_cursor(editor_t *editor) {
+  size_t pos = editor_caret(editor);
+  size_t line = line_index_line_of(&editor->lines, pos);
+  editor->cursor_line = line;
+  editor->cursor_col = column_index_col_of(
+      &editor->columns, line, pos - line_index_line_start(&editor->lines, line));
 }
 
-void editor_move_left(editor_t *editor) {
-  editor_cursor_recompute_ticks(editor);
-  char c = gap_peek_before(editor->buffer);
-  if (c == 0)
+size_t editor_caret(const editor_t *editor) {
+  return editor->selecting ? editor->head : editor->buffer->gap_start;
+}
+
+// Select the whole buffer. The caret is only drawn at the end; the gap
+// stays put, so this is O(1) however large the buffer is.
+void editor_select_all(editor_t *editor) {
+  editor->selecting = true;
+  editor->anchor = 0;
+  editor->head = editor->lines.length;
+  editor_sync_cursor(editor);
+}
+
+// Drop the selection and put the gap where the caret is drawn.
+void editor_clear_selection(editor_t *editor) {
+  if (!editor->selecting)
     return;
+  editor->selecting = false;
+  gap_move_to(editor->buffer, editor->head);
+  editor_sync_cursor(editor);
+}
 
-  gap_move_left(editor->buffer);
+// Run a caret movement that extends the selection instead of dropping it.
+void editor_select_with(editor_t *editor, void (*move)(editor_t *)) {
+  size_t anchor =
+      editor->selecting ? editor->anchor : editor->buffer->gap_start;
 
-  if (c == '\n') {
-    editor->cursor_line--;
-    editor->cursor_col = editor_get_line_length(editor, editor->cursor_line);
-  } else {
-    editor->cursor_col--;
+  editor_clear_selection(editor);
+  move(editor);
+
+  editor->selecting = true;
+  editor->anchor = anchor;
+  editor->head = editor->buffer->gap_start;
+  editor_sync_cursor(editor);
+}
+
+bool editor_get_selection(const editor_t *editor, size_t *start,
+                          size_t *end) {
+  if (!editor->selecting || editor->anchor == editor->head)
+    return false;
+  *start = editor->anchor < editor->head ? editor->anchor : editor->head;
+  *end = editor->anchor < editor->head ? editor->head : editor->anchor;
+  return true;
+}
+
+// Delete the selected text as one range. Returns false, after dropping an
+// empty selection, when nothing was selected.
+bool editor_delete_selection(editor_t *editor) {
+  size_t start, end;
+  if (!editor_get_selection(editor, &start, &end)) {
+    editor_clear_selection(editor);
+    return false;
   }
+  editor->selecting = false;
+  editor_delete_range(editor, start, end - start);
+  return true;
+}
+
+void editor_move_left(editor_t *editor) {
+  editor_clear_selection(editor);
+  editor_cursor_recompute_ticks(editor);
+  size_t pos = editor->buffer->gap_start;
+  if (pos == 0)
+    return;
+
+  gap_move_to(editor->buffer, utf8_prev_grapheme(editor->buffer, pos));
+  editor_sync_cursor(editor);
 }
 void editor_move_right(editor_t *editor) {
+  editor_clear_selection(editor);
   editor_cursor_recompute_ticks(editor);
-  char c = gap_peek_after(editor->buffer);
-  if (c == 0)
+  size_t pos = editor->buffer->gap_start;
+  if (pos >= editor->lines.length)
     return;
 
-  gap_move_right(editor->buffer);
+  gap_move_to(editor->buffer, utf8_next_grapheme(editor->buffer, pos));
+  editor_sync_cursor(editor);
+}
 
-  if (c == '\n') {
-    editor->cursor_line++;
-    editor->cursor_col = 0;
-  } else {
-    editor->cursor_col++;
-  }
+void editor_move_to(editor_t *editor, size_t pos) {
+  editor->selecting = false;
+  editor_cursor_recompute_ticks(editor);
+  gap_move_to(editor->buffer, pos);
+  editor_sync_cursor(editor);
 }
 
-int editor_count_lines(editor_t *e) {
-  char *s = malloc(e->buffer->capacity);
-  gap_to_string(e->buffer, s);
+int editor_count_lines(editor_t *e) { return e->lines.count; }
 
-  int lines = 1;
-  for (char *p = s; *p; p++) {
-    if (*p == '\n')
-      lines++;
-  }
-  free(s);
-  return lines;
+// Put the caret on `line` at the column nearest to `col`.
+static void editor_move_to_column(editor_t *editor, int line, int col) {
+  size_t start = line_index_line_start(&editor->lines, line);
+  gap_move_to(editor->buffer, start + editor_col_to_byte(editor, line, col));
+  editor_sync_cursor(editor);
 }
 
 void editor_move_up(editor_t *editor) {
+  editor_clear_selection(editor);
   if (editor->cursor_line == 0)
     return;
   editor_cursor_recompute_ticks(editor);
+  editor_move_to_column(editor, editor->cursor_line - 1, editor->cursor_col);
+}
+void editor_move_down(editor_t *editor) {
+  editor_clear_selection(editor);
+  int total_lines = editor_count_lines(editor);
+  if (editor->cursor_line >= total_lines - 1)
+    return;
+  editor_cursor_recompute_ticks(editor);
+  editor_move_to_column(editor, editor->cursor_line + 1, editor->cursor_col);
+}
 
-  int target_col = editor->cursor_col;
+// Size of an open regular file. Pipes and devices have none and are read as
+// a stream. Unlike ftell this is not limited to a long, which is 32 bits on
+// Windows.
+static bool file_size(FILE *f, size_t *size) {
+#ifdef _WIN32
+  struct _stat64 st;
+  if (_fstat64(_fileno(f), &st) != 0 || (st.st_mode & _S_IFMT) != _S_IFREG)
+    return false;
+#else
+  struct stat st;
+  if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode))
+    return false;
+#endif
+  if ((uint64_t)st.st_size > SIZE_MAX)
+    return false;
+  *size = (size_t)st.st_size;
+  return true;
+}
 
-  // Move left until hit \n
-  while (gap_peek_before(editor->buffer) != '\n') {
-    editor_move_left(editor);
-    if (editor->buffer->gap_start == 0)
-      break;
+bool editor_open_file(editor_t *editor, const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "Could not open %s.\n", path);
+    return false;
   }
 
-  // skip the new line it self
-  editor_move_left(editor);
+  gap_buffer_t *g = editor->buffer;
+  size_t old_len = editor->lines.length;
+  size_t old_lines = editor->lines.count;
 
-  // move right until target col or newline
-  int line_len = editor_get_line_length(editor, editor->cursor_line);
-  int col = (target_col > line_len ? line_len : target_col);
+  size_t size = 0;
+  bool sized = file_size(f, &size);
 
-  for (int i = 0; i < col; i++) {
-    if (gap_peek_after(editor->buffer) == '\n')
-      break;
-    editor_move_right(editor);
+  // Once the old text is dropped the whole buffer is gap; make sure the file
+  // fits before touching anything
+  if (sized && size > old_len && !gap_reserve(g, size - old_len)) {
+    fprintf(stderr, "Could not open %s.\n", path);
+    fclose(f);
+    return false;
   }
+
+  editor_prepare(editor, 0, old_len, 0);
+  editor->selecting = false;
+
+  // Drop the old text and read the file straight into the space after the
+  // gap, which leaves the caret at the start without moving any bytes
+  g->gap_start = 0;
+  g->gap_end = g->capacity;
+
+  if (sized) {
+    size_t n = fread(g->buffer + g->capacity - size, 1, size, f);
+    if (n < size)
+      memmove(g->buffer + g->capacity - n, g->buffer + g->capacity - size, n);
+    g->gap_end = g->capacity - n;
+  } else {
+    // A pipe or device: stream it in at the caret, then park the caret at 0
+    char *chunk = malloc(65536);
+    size_t n;
+    while (chunk && (n = fread(chunk, 1, 65536, f)) > 0) {
+      if (!gap_insert_bytes(g, chunk, n))
+        break;
+    }
+    free(chunk);
+    gap_move_to(g, 0);
+  }
+  fclose(f);
+
+  line_index_build(&editor->lines, g);
+
+  size_t path_len = strlen(path);
+  free(editor->path);
+  editor->path = malloc(path_len + 1);
+  if (editor->path)
+    memcpy(editor->path, path, path_len + 1);
+  editor->dirty = false;
+  editor_notify(editor, 0, old_len, editor->lines.length, old_lines);
+  editor_sync_cursor(editor);
+  return true;
 }
-void editor_move_down(editor_t *editor) {
-  int total_lines = editor_count_lines(editor);
-  if (editor->cursor_line >= total_lines - 1)
-    return;
-  editor_cursor_recompute_ticks(editor);
 
-  int target_col = editor->cursor_col;
+// Absolute path of `path` with symlinks resolved, in a new string. A file
+// that does not exist yet gets a copy of `path`.
+char *editor_resolve_path(const char *path) {
+#ifdef _WIN32
+  char *real = _fullpath(NULL, path, 0);
+#else
+  char *real = realpath(path, NULL);
+#endif
+  if (real)
+    return real;
+
+  size_t len = strlen(path);
+  char *copy = malloc(len + 1);
+  if (copy)
+    memcpy(copy, path, len + 1);
+  return copy;
+}
 
-  // move right until end of this line
-  while (gap_peek_after(editor->buffer) != '\n') {
-    editor_move_right(editor);
+// Create the file a save is written to, next to `target`, and store its
+// name in *tmp. On POSIX the name is unique, so concurrent saves never share
+// it, and the file takes the target's mode and, where allowed, its owner.
+static FILE *save_open_temp(const char *target, char **tmp) {
+  size_t len = strlen(target);
+  *tmp = malloc(len + 8);
+  if (!*tmp)
+    return NULL;
+  memcpy(*tmp, target, len);
+
+#ifdef _WIN32
+  memcpy(*tmp + len, ".tmp", 5);
+  FILE *f = fopen(*tmp, "wb");
+#else
+  memcpy(*tmp + len, ".XXXXXX", 8);
+  int fd = mkstemp(*tmp);
+  if (fd < 0) {
+    free(*tmp);
+    *tmp = NULL;
+    return NULL;
   }
 
-  // skip newline
-  editor_move_right(editor);
+  struct stat st;
+  if (stat(target, &st) == 0) {
+    if (fchmod(fd, st.st_mode & 07777) != 0 ||
+        (fchown(fd, st.st_uid, st.st_gid) != 0 && st.st_uid != getuid()))
+      fprintf(stderr, "Could not keep the mode and owner of %s.\n", target);
+  } else {
+    // mkstemp makes the file private; a new file gets the usual mode
+    mode_t mask = umask(0);
+    umask(mask);
+    if (fchmod(fd, 0666 & ~mask) != 0)
+      fprintf(stderr, "Could not set the mode of %s.\n", target);
+  }
 
-  int line_len = editor_get_line_length(editor, editor->cursor_line);
-  int col = (target_col > line_len ? line_len : target_col);
+  FILE *f = fdopen(fd, "wb");
+  if (!f)
+    close(fd);
+#endif
 
-  for (int i = 0; i < col; i++) {
-    if (gap_peek_after(editor->buffer) == '\n')
-      break;
-    editor_move_right(editor);
+  if (!f) {
+    remove(*tmp);
+    free(*tmp);
+    *tmp = NULL;
+  }
+  return f;
+}
+
+// Move the finished temporary file over the target in one step.
+static bool save_replace(const char *tmp, const char *target) {
+#ifdef _WIN32
+  return MoveFileExA(tmp, target,
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  return rename(tmp, target) == 0;
+#endif
+}
+
+// Write the text on both sides of the gap straight to disk, through a
+// temporary file so a failed save never truncates the original. A symlink
+// is followed, and the file it points to is the one replaced.
+bool editor_save(editor_t *editor, const char *path) {
+  gap_buffer_t *g = editor->buffer;
+  char *target = editor_resolve_path(path);
+  char *tmp = NULL;
+  FILE *f = target ? save_open_temp(target, &tmp) : NULL;
+  if (!f) {
+    fprintf(stderr, "Could not write %s.\n", path);
+    free(target);
+    return false;
+  }
+
+  size_t after = g->capacity - g->gap_end;
+  bool ok = fwrite(g->buffer, 1, g->gap_start, f) == g->gap_start &&
+            fwrite(g->buffer + g->gap_end, 1, after, f) == after;
+  ok = fclose(f) == 0 && ok;
+  ok = ok && save_replace(tmp, target);
+
+  // The original is untouched until the replace succeeds
+  if (!ok) {
+    fprintf(stderr, "Could not save %s.\n", path);
+    remove(tmp);
+  }
+  free(tmp);
+  free(target);
+
+  if (ok)
+    editor->dirty = false;
+  return ok;
+}
+
+// Append bytes at the end of the buffer. A caret already sitting at the end
+// follows the new text, which gives `tail -f` behaviour for growing files.
+bool editor_append(editor_t *editor, const char *data, size_t n) {
+  gap_buffer_t *g = editor->buffer;
+  if (!gap_reserve(g, n))
+    return false;
+
+  size_t end = editor->lines.length;
+  size_t old_lines = editor->lines.count;
+  editor_prepare(editor, end, 0, n);
+  if (!line_index_insert(&editor->lines, end, data, n)) {
+    editor_abort(editor, end);
+    return false;
+  }
+
+  if (g->gap_start == end)
+    gap_insert_bytes(g, data, n);
+  else
+    gap_append(g, data, n);
+  if (!editor->syncing)
+    editor->dirty = true;
+
+  editor_notify(editor, end, 0, n, old_lines);
+  editor_sync_cursor(editor);
+  return true;
+}
+
+bool editor_replace_range(editor_t *editor, size_t pos, size_t old_len,
+                          const char *data, size_t new_len) {
+  size_t len = editor->lines.length;
+  if (pos > len)
+    pos = len;
+  if (old_len > len - pos)
+    old_len = len - pos;
+  if (old_len == 0 && new_len == 0)
+    return true;
+  if (!gap_reserve(editor->buffer, new_len))
+    return false;
+
+  size_t caret = editor->buffer->gap_start;
+  size_t old_lines = editor->lines.count;
+  editor_prepare(editor, pos, old_len, new_len);
+
+  // Insert the new lines behind the old text before dropping it, so running
+  // out of memory leaves the index as it was
+  if (!line_index_insert(&editor->lines, pos + old_len, data, new_len)) {
+    editor_abort(editor, pos);
+    return false;
   }
+  line_index_delete(&editor->lines, pos, old_len);
+  gap_replace_range(editor->buffer, pos, old_len, data, new_len);
+  if (!editor->syncing)
+    editor->dirty = true;
+
+  // Keep the caret on the same text when the change is before it
+  if (caret >= pos + old_len)
+    caret = caret - old_len + new_len;
+  else if (caret > pos)
+    caret = pos;
+  gap_move_to(editor->buffer, caret);
+  editor_notify(editor, pos, old_len, new_len, old_lines);
+  editor_sync_cursor(editor);
+  return true;
 }
@@ -0,0 +1,390 @@
+#ifdef __linux__
+#define _DEFAULT_SOURCE
+#endif
+
+#include "../include/file_watch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+#define WATCH_EVENTS                                                           \
+  (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+
+static uint64_t fnv1a(uint64_t h, const char *data, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    h ^= (unsigned char)data[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+static bool read_at(int fd, char *out, size_t n, size_t offset) {
+  while (n > 0) {
+    ssize_t r = pread(fd, out, n, offset);
+    if (r <= 0)
+      return false;
+    out += r;
+    n -= r;
+    offset += r;
+  }
+  return true;
+}
+
+static bool hashes_reserve(file_watch_t *w, size_t n) {
+  if (w->block_capacity >= n)
+    return true;
+  size_t cap = w->block_capacity ? w->block_capacity : 16;
+  while (cap < n)
+    cap *= 2;
+  uint64_t *hashes = realloc(w->block_hashes, cap * sizeof(uint64_t));
+  if (!hashes)
+    return false;
+  w->block_hashes = hashes;
+  w->block_capacity = cap;
+  return true;
+}
+
+// Feed bytes that follow `known_size` into the block hashes. FNV-1a is
+// streaming, so a partial last block just continues from its stored hash.
+// Without memory for another block the hashes are marked stale, and the
+// next change reloads the whole file.
+static void hashes_extend(file_watch_t *w, const char *data, size_t n) {
+  while (n > 0) {
+    size_t offset = w->known_size % FILE_WATCH_BLOCK_SIZE;
+    if (offset == 0) {
+      if (!hashes_reserve(w, w->block_count + 1)) {
+        w->stale = true;
+        return;
+      }
+      w->block_hashes[w->block_count++] = FNV_OFFSET_BASIS;
+    }
+
+    size_t take = FILE_WATCH_BLOCK_SIZE - offset;
+    if (take > n)
+      take = n;
+
+    uint64_t *h = &w->block_hashes[w->block_count - 1];
+    *h = fnv1a(*h, data, take);
+
+    w->known_size += take;
+    data += take;
+    n -= take;
+  }
+}
+
+static void watch_add(file_watch_t *w) {
+  w->wd = inotify_add_watch(w->fd, w->path, WATCH_EVENTS);
+}
+
+static int64_t mtime_ns(const struct stat *st) {
+  return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+file_watch_t *file_watch_create(editor_t *editor) {
+  if (!editor->path)
+    return NULL;
+
+  file_watch_t *w = calloc(1, sizeof(file_watch_t));
+  if (!w)
+    return NULL;
+
+  size_t path_len = strlen(editor->path);
+  w->path = malloc(path_len + 1);
+  w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (!w->path || w->fd < 0) {
+    fprintf(stderr, "Could not watch %s for changes.\n", editor->path);
+    file_watch_destroy(w);
+    return NULL;
+  }
+  memcpy(w->path, editor->path, path_len + 1);
+
+  watch_add(w);
+  file_watch_resync(w, editor);
+  return w;
+}
+
+void file_watch_destroy(file_watch_t *w) {
+  if (!w)
+    return;
+  if (w->fd >= 0)
+    close(w->fd);
+  free(w->block_hashes);
+  free(w->path);
+  free(w);
+}
+
+// Rehash the buffer contents, which must match the file on disk.
+void file_watch_resync(file_watch_t *w, editor_t *editor) {
+  w->known_size = 0;
+  w->block_count = 0;
+  w->pending = false;
+  w->stale = false;
+
+  char *chunk = malloc(FILE_WATCH_BLOCK_SIZE);
+  if (!chunk) {
+    w->stale = true;
+    return;
+  }
+
+  struct stat st;
+  w->known_mtime = stat(w->path, &st) == 0 ? mtime_ns(&st) : -1;
+
+  size_t len = editor->lines.length;
+  for (size_t pos = 0; pos < len; pos += FILE_WATCH_BLOCK_SIZE) {
+    size_t n = gap_copy_range(editor->buffer, pos, FILE_WATCH_BLOCK_SIZE, chunk);
+    hashes_extend(w, chunk, n);
+  }
+
+  free(chunk);
+}
+
+static bool block_matches(file_watch_t *w, int fd, size_t block,
+                          char *chunk) {
+  size_t start = block * FILE_WATCH_BLOCK_SIZE;
+  size_t n = w->known_size - start;
+  if (n > FILE_WATCH_BLOCK_SIZE)
+    n = FILE_WATCH_BLOCK_SIZE;
+  if (!read_at(fd, chunk, n, start))
+    return false;
+  return fnv1a(FNV_OFFSET_BASIS, chunk, n) == w->block_hashes[block];
+}
+
+// The fast path for logs: the file only grew and its old head and tail are
+// intact. Checking both ends catches a rewrite that happens to keep one of
+// them, at the cost of reading at most two blocks.
+static bool is_append(file_watch_t *w, int fd, size_t size, char *chunk) {
+  if (w->stale || size <= w->known_size)
+    return false;
+  if (w->known_size == 0)
+    return true;
+
+  size_t last = w->block_count - 1;
+  return block_matches(w, fd, 0, chunk) &&
+         (last == 0 || block_matches(w, fd, last, chunk));
+}
+
+// Append the file past `known_size`. Returns false when it stopped short;
+// the hashes still describe what was appended, so a retry carries on.
+static bool apply_append(file_watch_t *w, editor_t *editor, int fd,
+                         size_t size, char *chunk, bool *changed) {
+  while (w->known_size < size && !w->stale) {
+    size_t n = size - w->known_size;
+    if (n > FILE_WATCH_BLOCK_SIZE)
+      n = FILE_WATCH_BLOCK_SIZE;
+    if (!read_at(fd, chunk, n, w->known_size) ||
+        !editor_append(editor, chunk, n))
+      return false;
+    hashes_extend(w, chunk, n);
+    *changed = true;
+  }
+  return w->known_size == size;
+}
+
+static bool replace_from_file(editor_t *editor, int fd, size_t pos,
+                              size_t old_len, size_t new_len) {
+  char *data = malloc(new_len ? new_len : 1);
+  if (!data)
+    return false;
+  bool ok = read_at(fd, data, new_len, pos) &&
+            editor_replace_range(editor, pos, old_len, data, new_len);
+  free(data);
+  return ok;
+}
+
+// Compare the file against the stored block hashes and splice only the
+// differing byte ranges into the buffer; stale hashes replace all of it. The
+// new hashes are kept only if every splice succeeded, otherwise the old ones
+// still describe what is left to do and the next poll retries.
+static bool apply_rewrite(file_watch_t *w, editor_t *editor, int fd,
+                          size_t size, char *chunk, bool *changed) {
+  size_t old_size = w->known_size;
+  size_t new_count =
+      (size + FILE_WATCH_BLOCK_SIZE - 1) / FILE_WATCH_BLOCK_SIZE;
+  uint64_t *new_hashes = malloc((new_count ? new_count : 1) * sizeof(uint64_t));
+  if (!new_hashes)
+    return false;
+
+  for (size_t i = 0; i < new_count; i++) {
+    size_t start = i * FILE_WATCH_BLOCK_SIZE;
+    size_t n = size - start < FILE_WATCH_BLOCK_SIZE ? size - start
+                                                    : FILE_WATCH_BLOCK_SIZE;
+    if (!read_at(fd, chunk, n, start)) {
+      free(new_hashes);
+      return false;
+    }
+    new_hashes[i] = fnv1a(FNV_OFFSET_BASIS, chunk, n);
+  }
+
+  bool ok = true;
+
+  if (w->stale) {
+    ok = replace_from_file(editor, fd, 0, editor->lines.length, size);
+    *changed = ok;
+  } else if (size == old_size) {
+    // Block boundaries line up, so each run of differing blocks is patched
+    // in place.
+    for (size_t i = 0; ok && i < new_count;) {
+      if (new_hashes[i] == w->block_hashes[i]) {
+        i++;
+        continue;
+      }
+      size_t first = i;
+      while (i < new_count && new_hashes[i] != w->block_hashes[i])
+        i++;
+      size_t pos = first * FILE_WATCH_BLOCK_SIZE;
+      size_t end = i * FILE_WATCH_BLOCK_SIZE < size ? i * FILE_WATCH_BLOCK_SIZE
+                                                    : size;
+      ok = replace_from_file(editor, fd, pos, end - pos, end - pos);
+      *changed |= ok;
+    }
+  } else {
+    size_t common = size < old_size ? size : old_size;
+
+    size_t prefix = 0;
+    // Only whole blocks can match: a partial last block changed length
+    while (prefix + FILE_WATCH_BLOCK_SIZE <= common &&
+           new_hashes[prefix / FILE_WATCH_BLOCK_SIZE] ==
+               w->block_hashes[prefix / FILE_WATCH_BLOCK_SIZE])
+      prefix += FILE_WATCH_BLOCK_SIZE;
+
+    // Insertions shift the tail, so match it block by block from the end
+    char *old_chunk = malloc(FILE_WATCH_BLOCK_SIZE);
+    size_t suffix = 0;
+    while (old_chunk && prefix + suffix < common) {
+      size_t n = common - prefix - suffix;
+      if (n > FILE_WATCH_BLOCK_SIZE)
+        n = FILE_WATCH_BLOCK_SIZE;
+      if (!read_at(fd, chunk, n, size - suffix - n))
+        break;
+      gap_copy_range(editor->buffer, old_size - suffix - n, n, old_chunk);
+      if (memcmp(chunk, old_chunk, n) != 0)
+        break;
+      suffix += n;
+    }
+    free(old_chunk);
+
+    ok = replace_from_file(editor, fd, prefix, old_size - prefix - suffix,
+                           size - prefix - suffix);
+    *changed = ok;
+  }
+
+  if (!ok) {
+    free(new_hashes);
+    return false;
+  }
+  free(w->block_hashes);
+  w->block_hashes = new_hashes;
+  w->block_count = new_count;
+  w->block_capacity = new_count ? new_count : 1;
+  w->known_size = size;
+  w->stale = false;
+  return true;
+}
+
+bool file_watch_poll(file_watch_t *w, editor_t *editor) {
+  char events[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool touched = false;
+
+  // Events only say that something happened; whether the file grew or was
+  // rewritten is decided below from its size and block hashes, since loggers
+  // and `>>` open, append and close for every write
+  ssize_t len;
+  while ((len = read(w->fd, events, sizeof(events))) > 0) {
+    for (char *p = events; p < events + len;) {
+      const struct inotify_event *ev = (const struct inotify_event *)p;
+      touched = true;
+      if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)) {
+        // Replaced by rename (atomic save); watch the new file instead
+        inotify_rm_watch(w->fd, w->wd);
+        w->wd = -1;
+      }
+      p += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+
+  if (w->wd < 0) {
+    watch_add(w);
+    if (w->wd < 0)
+      return false;
+    touched = true;
+  }
+
+  if (!touched && !w->pending)
+    return false;
+
+  if (editor->dirty) {
+    if (touched)
+      fprintf(stderr, "%s changed on disk; keeping unsaved edits.\n",
+              w->path);
+    w->pending = false;
+    return false;
+  }
+
+  int fd = open(w->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  char *chunk = malloc(FILE_WATCH_BLOCK_SIZE);
+  bool changed = false;
+  w->pending = true;
+
+  if (chunk && fstat(fd, &st) == 0) {
+    size_t size = st.st_size;
+    int64_t mtime = mtime_ns(&st);
+    // Same size and time is the close or attribute change after a write that
+    // was already followed. Anything else is synced with `syncing` set, so
+    // the buffer, which keeps matching the file, stays clean.
+    bool synced = size == w->known_size && mtime == w->known_mtime &&
+                  !w->stale;
+    if (!synced) {
+      editor->syncing = true;
+      if (is_append(w, fd, size, chunk))
+        synced = apply_append(w, editor, fd, size, chunk, &changed);
+      else
+        synced = apply_rewrite(w, editor, fd, size, chunk, &changed);
+      editor->syncing = false;
+    }
+    if (synced) {
+      w->known_mtime = mtime;
+      w->pending = false;
+    }
+  }
+
+  free(chunk);
+  close(fd);
+  return changed;
+}
+
+#else
+
+file_watch_t *file_watch_create(editor_t *editor) {
+  (void)editor;
+  return NULL;
+}
+
+void file_watch_destroy(file_watch_t *w) { (void)w; }
+
+void file_watch_resync(file_watch_t *w, editor_t *editor) {
+  (void)w;
+  (void)editor;
+}
+
+bool file_watch_poll(file_watch_t *w, editor_t *editor) {
+  (void)w;
+  (void)editor;
+  return false;
+}
+
+#endif
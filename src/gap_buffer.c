@@ -40,11 +40,21 @@ char gap_peek_after(gap_buffer_t *g) {
   return g->buffer[g->gap_end];
 }
 
-void gap_expand(gap_buffer_t *g) {
+// Grow the buffer so the gap can hold at least `needed` more bytes. Text
+// after the gap is kept flush against the end of the new allocation. On
+// failure the buffer is left as it was.
+static bool gap_grow(gap_buffer_t *g, size_t needed) {
   size_t old_cap = g->capacity;
-  size_t new_cap = old_cap * 2;
+  size_t used = old_cap - (g->gap_end - g->gap_start);
+  size_t new_cap = old_cap ? old_cap * 2 : 64;
+  while (new_cap - used < needed)
+    new_cap *= 2;
 
   char *new_buff = malloc(new_cap);
+  if (!new_buff) {
+    fprintf(stderr, "Could not grow gap buffer to %zu bytes.\n", new_cap);
+    return false;
+  }
 
   size_t before = g->gap_start;
   size_t after = old_cap - g->gap_end;
@@ -60,13 +70,83 @@ void gap_expand(gap_buffer_t *g) {
   g->buffer = new_buff;
   g->capacity = new_cap;
   g->gap_end = new_gap_end;
+  return true;
 }
 
-void gap_insert_char(gap_buffer_t *gap, const char c) {
-  if (gap->gap_start == gap->gap_end) {
-    gap_expand(gap);
-  }
+bool gap_expand(gap_buffer_t *g) { return gap_grow(g, 1); }
+
+// Make room for n more bytes in the gap. Once this succeeds, inserting up to
+// n bytes cannot fail.
+bool gap_reserve(gap_buffer_t *g, size_t n) {
+  if (g->gap_end - g->gap_start >= n)
+    return true;
+  return gap_grow(g, n);
+}
+
+bool gap_insert_char(gap_buffer_t *gap, const char c) {
+  if (gap->gap_start == gap->gap_end && !gap_expand(gap))
+    return false;
   gap->buffer[gap->gap_start++] = c;
+  return true;
+}
+
+bool gap_insert_bytes(gap_buffer_t *g, const char *data, size_t n) {
+  if (!gap_reserve(g, n))
+    return false;
+  memcpy(g->buffer + g->gap_start, data, n);
+  g->gap_start += n;
+  return true;
+}
+
+// Append after the last character without moving the caret (gap). The text
+// after the gap slides left into the gap to make room at the end.
+bool gap_append(gap_buffer_t *g, const char *data, size_t n) {
+  if (!gap_reserve(g, n))
+    return false;
+  size_t after = g->capacity - g->gap_end;
+  memmove(g->buffer + g->gap_end - n, g->buffer + g->gap_end, after);
+  g->gap_end -= n;
+  memcpy(g->buffer + g->capacity - n, data, n);
+  return true;
+}
+
+// Replace [pos, pos + old_len) with new_len bytes. The room for the new text
+// is reserved first, so a failure leaves the old text in place.
+bool gap_replace_range(gap_buffer_t *g, size_t pos, size_t old_len,
+                       const char *data, size_t new_len) {
+  if (!gap_reserve(g, new_len))
+    return false;
+  gap_move_to(g, pos);
+  if (old_len > g->capacity - g->gap_end)
+    old_len = g->capacity - g->gap_end;
+  g->gap_end += old_len;
+  return gap_insert_bytes(g, data, new_len);
+}
+
+// Insert a copy of the text at [src, src + n) at the caret, copied straight
+// from both sides of the gap into it without an intermediate string.
+bool gap_insert_range(gap_buffer_t *g, size_t src, size_t n) {
+  if (!gap_reserve(g, n))
+    return false;
+  g->gap_start += gap_copy_range(g, src, n, g->buffer + g->gap_start);
+  return true;
+}
+
+// Delete the text at [pos, pos + n). A range ending at the caret just
+// shrinks the gap; anything else moves the gap to pos once and widens it.
+void gap_delete_range(gap_buffer_t *g, size_t pos, size_t n) {
+  size_t len = gap_buffer_length(g);
+  if (pos > len)
+    pos = len;
+  if (n > len - pos)
+    n = len - pos;
+
+  if (g->gap_start == pos + n) {
+    g->gap_start = pos;
+  } else {
+    gap_move_to(g, pos);
+    g->gap_end += n;
+  }
 }
 
 void gap_delete_char(gap_buffer_t *g) {
@@ -86,6 +166,26 @@ void gap_move_right(gap_buffer_t *g) {
   }
 }
 
+// Move the gap so that it starts at text offset `pos`, shifting the bytes in
+// between with a single memmove instead of one char at a time.
+void gap_move_to(gap_buffer_t *g, size_t pos) {
+  size_t len = gap_buffer_length(g);
+  if (pos > len)
+    pos = len;
+
+  if (pos < g->gap_start) {
+    size_t n = g->gap_start - pos;
+    memmove(g->buffer + g->gap_end - n, g->buffer + pos, n);
+    g->gap_start -= n;
+    g->gap_end -= n;
+  } else if (pos > g->gap_start) {
+    size_t n = pos - g->gap_start;
+    memmove(g->buffer + g->gap_start, g->buffer + g->gap_end, n);
+    g->gap_start += n;
+    g->gap_end += n;
+  }
+}
+
 void gap_print(const gap_buffer_t *g) {
   printf("Buffer (capacity=%zu):\n", g->capacity);
   printf("[");
@@ -130,3 +230,35 @@ void gap_to_string(const gap_buffer_t *g, char *out) {
 
   out[left_len + right_len] = '\0';
 }
+
+char gap_char_at(const gap_buffer_t *g, size_t pos) {
+  if (pos < g->gap_start)
+    return g->buffer[pos];
+  pos += g->gap_end - g->gap_start;
+  if (pos >= g->capacity)
+    return 0;
+  return g->buffer[pos];
+}
+
+size_t gap_copy_range(const gap_buffer_t *g, size_t pos, size_t n,
+                      char *out) {
+  size_t len = gap_buffer_length(g);
+  if (pos >= len)
+    return 0;
+  if (n > len - pos)
+    n = len - pos;
+
+  size_t copied = 0;
+  if (pos < g->gap_start) {
+    size_t left = g->gap_start - pos;
+    if (left > n)
+      left = n;
+    memcpy(out, g->buffer + pos, left);
+    copied = left;
+  }
+  if (copied < n) {
+    size_t raw = pos + copied + (g->gap_end - g->gap_start);
+    memcpy(out + copied, g->buffer + raw, n - copied);
+  }
+  return n;
+}
@@ -0,0 +1,370 @@
+#include "../include/line_diff.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+// Edit script steps, saved-version side first
+enum { OP_KEEP, OP_DELETE, OP_INSERT };
+
+static uint64_t hash_line(const editor_t *editor, size_t line) {
+  size_t pos = line_index_line_start(&editor->lines, line);
+  size_t len = line_index_line_length(&editor->lines, line);
+  uint64_t h = FNV_OFFSET_BASIS;
+  char buf[4096];
+
+  while (len > 0) {
+    size_t n = gap_copy_range(editor->buffer, pos,
+                              len < sizeof(buf) ? len : sizeof(buf), buf);
+    if (n == 0)
+      break;
+    for (size_t i = 0; i < n; i++) {
+      h ^= (unsigned char)buf[i];
+      h *= FNV_PRIME;
+    }
+    pos += n;
+    len -= n;
+  }
+  return h;
+}
+
+static bool reserve_lines(line_diff_t *d, size_t n) {
+  if (n <= d->live_capacity)
+    return true;
+
+  size_t cap = d->live_capacity ? d->live_capacity : 1024;
+  while (cap < n)
+    cap *= 2;
+
+  uint64_t *live = realloc(d->live, cap * sizeof(uint64_t));
+  if (!live)
+    return false;
+  d->live = live;
+  size_t *base_of = realloc(d->base_of, cap * sizeof(size_t));
+  if (!base_of)
+    return false;
+  d->base_of = base_of;
+  uint8_t *marks = realloc(d->marks, cap);
+  if (!marks)
+    return false;
+  d->marks = marks;
+
+  d->live_capacity = cap;
+  return true;
+}
+
+static bool reserve_ops(line_diff_t *d, size_t n) {
+  if (n <= d->ops_capacity)
+    return true;
+  size_t cap = d->ops_capacity ? d->ops_capacity : 4096;
+  while (cap < n)
+    cap *= 2;
+  uint8_t *ops = realloc(d->ops, cap);
+  if (!ops)
+    return false;
+  d->ops = ops;
+  d->ops_capacity = cap;
+  return true;
+}
+
+static bool reserve_base(line_diff_t *d, size_t n) {
+  if (n <= d->base_capacity)
+    return true;
+  size_t cap = d->base_capacity ? d->base_capacity : 1024;
+  while (cap < n)
+    cap *= 2;
+  uint64_t *base = realloc(d->base, cap * sizeof(uint64_t));
+  if (!base)
+    return false;
+  d->base = base;
+  d->base_capacity = cap;
+  return true;
+}
+
+// The saved version becomes the current buffer; no line is marked.
+void line_diff_rebase(line_diff_t *d) {
+  if (!reserve_base(d, d->live_count)) {
+    fprintf(stderr, "Could not store the saved line hashes.\n");
+    return;
+  }
+  memcpy(d->base, d->live, d->live_count * sizeof(uint64_t));
+  d->base_count = d->live_count;
+
+  for (size_t i = 0; i < d->live_count; i++)
+    d->base_of[i] = i;
+  memset(d->marks, 0, d->live_count);
+  d->tail_deleted = false;
+}
+
+// Myers' O((n + m) D) diff of a against b, writing the edit script to `ops`.
+// Gives up once more than LINE_DIFF_MAX_EDITS edits would be needed.
+static bool myers(line_diff_t *d, const uint64_t *a, long n, const uint64_t *b,
+                  long m, uint8_t *ops, size_t *op_count) {
+  long dmax = n + m < LINE_DIFF_MAX_EDITS ? n + m : LINE_DIFF_MAX_EDITS;
+  long v[2 * LINE_DIFF_MAX_EDITS + 3];
+  long off = dmax + 1;
+
+  v[off + 1] = 0;
+  for (long e = 0; e <= dmax; e++) {
+    for (long k = -e; k <= e; k += 2) {
+      long x;
+      if (k == -e || (k != e && v[off + k - 1] < v[off + k + 1]))
+        x = v[off + k + 1];
+      else
+        x = v[off + k - 1] + 1;
+      long y = x - k;
+      while (x < n && y < m && a[x] == b[y]) {
+        x++;
+        y++;
+      }
+      v[off + k] = x;
+      if (x < n || y < m)
+        continue;
+
+      // Walk back through the saved rounds, emitting the script reversed
+      size_t count = 0;
+      for (long step = e; step > 0; step--) {
+        const long *prev = d->trace + (step - 1) * (step - 1) + (step - 1);
+        long kk = x - y;
+        bool down = kk == -step ||
+                    (kk != step && prev[kk - 1] < prev[kk + 1]);
+        long pk = down ? kk + 1 : kk - 1;
+        long px = prev[pk];
+        long py = px - pk;
+        long sx = down ? px : px + 1; // where the diagonal started
+        while (x > sx) {
+          ops[count++] = OP_KEEP;
+          x--;
+          y--;
+        }
+        ops[count++] = down ? OP_INSERT : OP_DELETE;
+        x = px;
+        y = py;
+      }
+      while (x > 0) {
+        ops[count++] = OP_KEEP;
+        x--;
+      }
+
+      for (size_t i = 0; i < count / 2; i++) {
+        uint8_t t = ops[i];
+        ops[i] = ops[count - 1 - i];
+        ops[count - 1 - i] = t;
+      }
+      *op_count = count;
+      return true;
+    }
+
+    // Save this round for the walk back; round e needs (e + 1)^2 slots
+    size_t need = (size_t)(e + 1) * (e + 1);
+    if (need > d->trace_capacity) {
+      size_t cap = d->trace_capacity ? d->trace_capacity * 2 : 4096;
+      while (cap < need)
+        cap *= 2;
+      long *trace = realloc(d->trace, cap * sizeof(long));
+      if (!trace)
+        return false;
+      d->trace = trace;
+      d->trace_capacity = cap;
+    }
+    memcpy(d->trace + e * e, v + off - e, (2 * e + 1) * sizeof(long));
+  }
+  return false;
+}
+
+// Turn an edit script for saved lines from b0 and live lines [lo, hi) into
+// marks: replaced lines are modified, extra ones added, and a run that deletes
+// more lines than it inserts flags the line after it.
+static void apply_ops(line_diff_t *d, size_t b0, size_t lo, size_t hi,
+                      const uint8_t *ops, size_t count) {
+  size_t x = b0, y = lo;
+  bool deleted = false;
+
+  for (size_t i = 0; i < count;) {
+    if (ops[i] == OP_KEEP) {
+      d->base_of[y] = x++;
+      d->marks[y++] = deleted ? LINE_DIFF_DELETED_ABOVE : 0;
+      deleted = false;
+      i++;
+      continue;
+    }
+
+    size_t dels = 0, ins = 0, y0 = y;
+    for (; i < count && ops[i] != OP_KEEP; i++) {
+      if (ops[i] == OP_DELETE) {
+        dels++;
+        x++;
+      } else {
+        ins++;
+        y++;
+      }
+    }
+    for (size_t j = 0; j < ins; j++) {
+      d->base_of[y0 + j] = LINE_DIFF_NONE;
+      d->marks[y0 + j] = j < dels ? LINE_DIFF_MODIFIED : LINE_DIFF_ADDED;
+    }
+    deleted = dels > ins;
+  }
+
+  if (hi < d->live_count) {
+    d->marks[hi] &= ~LINE_DIFF_DELETED_ABOVE;
+    if (deleted)
+      d->marks[hi] |= LINE_DIFF_DELETED_ABOVE;
+  } else {
+    d->tail_deleted = deleted;
+  }
+}
+
+// Re-diff the live lines [lo, hi), widened to the hunk around them: out to
+// the nearest lines still known to equal a saved line. Lines outside it keep
+// their cached marks.
+static void rediff(line_diff_t *d, size_t lo, size_t hi) {
+  while (lo > 0 && d->base_of[lo - 1] == LINE_DIFF_NONE)
+    lo--;
+  while (hi < d->live_count && d->base_of[hi] == LINE_DIFF_NONE)
+    hi++;
+
+  size_t b0 = lo > 0 ? d->base_of[lo - 1] + 1 : 0;
+  size_t b1 = hi < d->live_count ? d->base_of[hi] : d->base_count;
+  const uint64_t *a = d->base + b0;
+  const uint64_t *b = d->live + lo;
+  size_t n = b1 - b0, m = hi - lo;
+
+  if (!reserve_ops(d, n + m)) {
+    fprintf(stderr, "Could not diff changed lines.\n");
+    return;
+  }
+
+  // Lines kept at both ends need no diff
+  size_t pre = 0, suf = 0;
+  while (pre < n && pre < m && a[pre] == b[pre])
+    pre++;
+  while (suf < n - pre && suf < m - pre &&
+         a[n - 1 - suf] == b[m - 1 - suf])
+    suf++;
+
+  uint8_t *ops = d->ops;
+  size_t count = 0;
+  memset(ops, OP_KEEP, pre);
+  count += pre;
+
+  size_t mid = 0;
+  if (!myers(d, a + pre, n - pre - suf, b + pre, m - pre - suf, ops + count,
+             &mid)) {
+    // Too different to be worth aligning: pair the lines up in order
+    mid = 0;
+    for (size_t i = pre; i < n - suf; i++)
+      ops[count + mid++] = OP_DELETE;
+    for (size_t i = pre; i < m - suf; i++)
+      ops[count + mid++] = OP_INSERT;
+  }
+  count += mid;
+
+  memset(ops + count, OP_KEEP, suf);
+  count += suf;
+
+  apply_ops(d, b0, lo, hi, ops, count);
+}
+
+// Called with the editor lock held, right after each edit: rehash the lines
+// the edit covers and re-diff the hunk they fall in.
+static void line_diff_on_change(void *ctx, const editor_change_t *change) {
+  line_diff_t *d = ctx;
+  const editor_t *editor = d->editor;
+
+  size_t first = change->first_line;
+  size_t last =
+      line_index_line_of(&editor->lines, change->pos + change->inserted);
+  size_t old_end = last + 1 - change->line_delta; // past the old lines
+  size_t count = editor->lines.count;
+
+  if (!reserve_lines(d, count)) {
+    fprintf(stderr, "Could not track changed lines.\n");
+    return;
+  }
+
+  size_t tail = d->live_count - old_end;
+  if (change->line_delta != 0) {
+    memmove(d->live + last + 1, d->live + old_end, tail * sizeof(uint64_t));
+    memmove(d->base_of + last + 1, d->base_of + old_end,
+            tail * sizeof(size_t));
+    memmove(d->marks + last + 1, d->marks + old_end, tail);
+  }
+  for (size_t line = first; line <= last; line++) {
+    d->live[line] = hash_line(editor, line);
+    d->base_of[line] = LINE_DIFF_NONE;
+    d->marks[line] = 0;
+  }
+  size_t old_count = d->live_count;
+  d->live_count = count;
+
+  if (editor->dirty) {
+    rediff(d, first, last + 1);
+    return;
+  }
+
+  // A clean buffer matches the file. A load starts over; anything else came
+  // from disk and is made to the saved version too, which for an append
+  // only touches the new lines.
+  bool loaded = change->pos == 0 && change->inserted == editor->lines.length;
+  if (loaded || d->base_count != old_count || !reserve_base(d, count)) {
+    line_diff_rebase(d);
+    return;
+  }
+  if (change->line_delta != 0)
+    memmove(d->base + last + 1, d->base + old_end, tail * sizeof(uint64_t));
+  memcpy(d->base + first, d->live + first,
+         (last + 1 - first) * sizeof(uint64_t));
+  d->base_count = count;
+
+  size_t moved = change->line_delta != 0 ? count : last + 1;
+  for (size_t line = first; line < moved; line++)
+    d->base_of[line] = line;
+}
+
+line_diff_t *line_diff_create(editor_t *editor) {
+  line_diff_t *d = calloc(1, sizeof(line_diff_t));
+  if (!d)
+    return NULL;
+  d->editor = editor;
+
+  editor_lock(editor);
+  size_t count = editor->lines.count;
+  if (!reserve_lines(d, count)) {
+    editor_unlock(editor);
+    fprintf(stderr, "Could not track changed lines.\n");
+    line_diff_destroy(d);
+    return NULL;
+  }
+  for (size_t line = 0; line < count; line++)
+    d->live[line] = hash_line(editor, line);
+  d->live_count = count;
+  line_diff_rebase(d);
+  editor_add_listener(editor, line_diff_on_change, d);
+  editor_unlock(editor);
+
+  return d;
+}
+
+void line_diff_destroy(line_diff_t *d) {
+  if (!d)
+    return;
+
+  editor_lock(d->editor);
+  editor_remove_listener(d->editor, line_diff_on_change, d);
+  editor_unlock(d->editor);
+
+  free(d->base);
+  free(d->live);
+  free(d->base_of);
+  free(d->marks);
+  free(d->trace);
+  free(d->ops);
+  free(d);
+}
+
+uint8_t line_diff_mark(const line_diff_t *d, size_t line) {
+  return line < d->live_count ? d->marks[line] : 0;
+}
@@ -0,0 +1,170 @@
+#include "../include/line_index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_INDEX_SCAN_CHUNK 65536
+
+// Slots between the gap and the entries stored after it
+static size_t line_index_hole(const line_index_t *li) {
+  return li->capacity - li->count;
+}
+
+static size_t line_index_get(const line_index_t *li, size_t line) {
+  if (line < li->gap)
+    return li->starts[line];
+  return li->length - li->starts[line + line_index_hole(li)];
+}
+
+// Make room for n lines. The entries after the gap move to the end of the
+// new allocation, as in gap_grow.
+static bool line_index_reserve(line_index_t *li, size_t n) {
+  if (li->capacity >= n)
+    return true;
+  size_t cap = li->capacity ? li->capacity : 64;
+  while (cap < n)
+    cap *= 2;
+  size_t *starts = realloc(li->starts, cap * sizeof(size_t));
+  if (!starts) {
+    fprintf(stderr, "Could not grow line index to %zu lines.\n", cap);
+    return false;
+  }
+
+  size_t after = li->count - li->gap;
+  memmove(starts + cap - after, starts + li->capacity - after,
+          after * sizeof(size_t));
+  li->starts = starts;
+  li->capacity = cap;
+  return true;
+}
+
+// Move the gap in front of `line`, converting the entries it passes between
+// absolute offsets and distances from the end.
+static void line_index_move_gap(line_index_t *li, size_t line) {
+  size_t hole = line_index_hole(li);
+
+  while (li->gap > line) {
+    li->gap--;
+    li->starts[li->gap + hole] = li->length - li->starts[li->gap];
+  }
+  while (li->gap < line) {
+    li->starts[li->gap] = li->length - li->starts[li->gap + hole];
+    li->gap++;
+  }
+}
+
+// Index of the first line that starts strictly after `pos`.
+static size_t line_index_upper_bound(const line_index_t *li, size_t pos) {
+  size_t lo = 0, hi = li->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (line_index_get(li, mid) <= pos)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+void line_index_init(line_index_t *li) {
+  li->starts = NULL;
+  li->count = 0;
+  li->capacity = 0;
+  li->gap = 0;
+  li->length = 0;
+  if (!line_index_reserve(li, 1))
+    return;
+  li->starts[li->count++] = 0;
+  li->gap = 1;
+}
+
+void line_index_free(line_index_t *li) {
+  free(li->starts);
+  li->starts = NULL;
+  li->count = 0;
+  li->capacity = 0;
+  li->gap = 0;
+  li->length = 0;
+}
+
+void line_index_build(line_index_t *li, const gap_buffer_t *g) {
+  size_t len = gap_buffer_length(g);
+  char *chunk = malloc(LINE_INDEX_SCAN_CHUNK);
+  if (!chunk)
+    return;
+
+  // Every entry goes before the gap, which ends up after the last line
+  li->count = 1;
+  li->gap = 1;
+  li->starts[0] = 0;
+  li->length = len;
+
+  for (size_t pos = 0; pos < len; pos += LINE_INDEX_SCAN_CHUNK) {
+    size_t n = gap_copy_range(g, pos, LINE_INDEX_SCAN_CHUNK, chunk);
+    for (const char *p = chunk; (p = memchr(p, '\n', chunk + n - p)); p++) {
+      if (!line_index_reserve(li, li->count + 1))
+        break;
+      li->starts[li->count++] = pos + (p - chunk) + 1;
+      li->gap++;
+    }
+  }
+
+  free(chunk);
+}
+
+// Lines after the insertion keep their distance from the end, so this costs
+// the newlines inserted plus the lines the gap moves over. Fails, leaving
+// the index unchanged, when the new lines do not fit.
+bool line_index_insert(line_index_t *li, size_t pos, const char *data,
+                       size_t n) {
+  size_t added = 0;
+  for (const char *p = data; (p = memchr(p, '\n', data + n - p)); p++)
+    added++;
+
+  if (!line_index_reserve(li, li->count + added))
+    return false;
+
+  line_index_move_gap(li, line_index_upper_bound(li, pos));
+  for (const char *p = data; (p = memchr(p, '\n', data + n - p)); p++)
+    li->starts[li->gap++] = pos + (p - data) + 1;
+  li->count += added;
+
+  li->length += n;
+  return true;
+}
+
+void line_index_delete(line_index_t *li, size_t pos, size_t n) {
+  if (pos >= li->length)
+    return;
+  if (n > li->length - pos)
+    n = li->length - pos;
+
+  // Lines starting inside (pos, pos + n] lose their newline and merge; they
+  // sit right after the gap, which just widens over them
+  size_t first = line_index_upper_bound(li, pos);
+  size_t last = line_index_upper_bound(li, pos + n);
+
+  line_index_move_gap(li, first);
+  li->count -= last - first;
+
+  li->length -= n;
+}
+
+size_t line_index_line_of(const line_index_t *li, size_t pos) {
+  return line_index_upper_bound(li, pos) - 1;
+}
+
+size_t line_index_line_start(const line_index_t *li, size_t line) {
+  if (line >= li->count)
+    return li->length;
+  return line_index_get(li, line);
+}
+
+size_t line_index_line_length(const line_index_t *li, size_t line) {
+  if (line >= li->count)
+    return 0;
+  size_t start = line_index_get(li, line);
+  if (line + 1 < li->count)
+    return line_index_get(li, line + 1) - start - 1;
+  return li->length - start;
+}
@@ -0,0 +1,392 @@
+#include "../include/minimap.h"
+#include "SDL_log.h"
+#include "SDL_timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MINIMAP_BG 30  // grey level of empty space
+#define MINIMAP_FG 170 // grey level of a fully covered pixel
+
+// Lines rendered per batch, synchronously or by the builder between lock
+// releases
+#define MINIMAP_BATCH_LINES 16384
+// Lines whose cached runs an edit recombines synchronously
+#define MINIMAP_RECOMBINE_LINES (1 << 20)
+
+static bool reserve_runs(minimap_t *m, size_t n) {
+  if (n <= m->run_capacity)
+    return true;
+  size_t cap = m->run_capacity ? m->run_capacity : 4096;
+  while (cap < n)
+    cap *= 2;
+  minimap_run_t *runs = realloc(m->runs, cap * sizeof(minimap_run_t));
+  if (!runs)
+    return false;
+  m->runs = runs;
+  m->run_capacity = cap;
+  return true;
+}
+
+static void minimap_relayout(minimap_t *m) {
+  size_t lines = m->editor->lines.count;
+
+  // Without room the runs stop short and blended rows read the text instead
+  reserve_runs(m, lines);
+
+  m->line_count = lines;
+  if (lines * 2 <= MINIMAP_MAX_ROWS) {
+    m->px_per_line = 2;
+    m->lines_per_row = 1;
+    m->rows = lines * 2;
+  } else if (lines <= MINIMAP_MAX_ROWS) {
+    m->px_per_line = 1;
+    m->lines_per_row = 1;
+    m->rows = lines;
+  } else {
+    m->px_per_line = 1;
+    m->lines_per_row = (lines + MINIMAP_MAX_ROWS - 1) / MINIMAP_MAX_ROWS;
+    m->rows = (lines + m->lines_per_row - 1) / m->lines_per_row;
+  }
+}
+
+static size_t row_first_line(const minimap_t *m, int row) {
+  if (m->px_per_line == 2)
+    return row / 2;
+  return row * m->lines_per_row;
+}
+
+static int line_row(const minimap_t *m, size_t line) {
+  if (m->px_per_line == 2)
+    return line * 2;
+  return line / m->lines_per_row;
+}
+
+static void mark_dirty(minimap_t *m, int first, int last) {
+  if (first < m->dirty_first)
+    m->dirty_first = first;
+  if (last > m->dirty_last)
+    m->dirty_last = last;
+}
+
+// Read the first MINIMAP_WIDTH bytes of a line and return the columns that
+// hold text. `cover`, when given, also counts each covered pixel.
+static minimap_run_t measure_line(const editor_t *e, size_t line,
+                                  uint32_t *cover) {
+  char text[MINIMAP_WIDTH];
+  size_t start = line_index_line_start(&e->lines, line);
+  size_t len = line_index_line_length(&e->lines, line);
+  if (len > MINIMAP_WIDTH)
+    len = MINIMAP_WIDTH;
+  gap_copy_range(e->buffer, start, len, text);
+
+  minimap_run_t run = {0, 0};
+  for (size_t x = 0; x < len; x++) {
+    if (text[x] == ' ' || text[x] == '\t' || text[x] == '\r')
+      continue;
+    if (cover)
+      cover[x]++;
+    if (run.end == 0)
+      run.start = x;
+    run.end = x + 1;
+  }
+  return run;
+}
+
+// Render one pixel row from the lines it covers. A row of one line shows
+// its exact pixels; a blended row sums the runs of its lines, taken from the
+// cache when they are there. Returns the lines visited.
+static size_t render_row(minimap_t *m, int row) {
+  editor_t *e = m->editor;
+  uint32_t cover[MINIMAP_WIDTH] = {0};
+  int32_t edges[MINIMAP_WIDTH + 1] = {0};
+  bool blend = m->lines_per_row > 1;
+
+  size_t first = row_first_line(m, row);
+  size_t last = first + (m->px_per_line == 2 ? 1 : m->lines_per_row);
+  if (last > e->lines.count)
+    last = e->lines.count;
+
+  for (size_t line = first; line < last; line++) {
+    minimap_run_t run;
+    if (blend && line < m->runs_valid) {
+      run = m->runs[line];
+    } else {
+      run = measure_line(e, line, blend ? NULL : cover);
+      if (line == m->runs_valid && line < m->run_capacity)
+        m->runs[m->runs_valid++] = run;
+    }
+    edges[run.start]++;
+    edges[run.end]--;
+  }
+  if (blend) {
+    int32_t covered = 0;
+    for (int x = 0; x < MINIMAP_WIDTH; x++) {
+      covered += edges[x];
+      cover[x] = covered;
+    }
+  }
+
+  size_t n = last > first ? last - first : 1;
+  uint32_t *out = m->pixels + (size_t)row * MINIMAP_WIDTH;
+  for (int x = 0; x < MINIMAP_WIDTH; x++) {
+    uint32_t v = MINIMAP_BG + (MINIMAP_FG - MINIMAP_BG) * cover[x] / n;
+    out[x] = 0xFF000000 | v << 16 | v << 8 | v;
+  }
+
+  return n;
+}
+
+static int minimap_build(void *data) {
+  minimap_t *m = data;
+
+  editor_lock(m->editor);
+  while (!m->quit) {
+    if (m->next_row >= m->rows) {
+      SDL_CondWait(m->wake, m->editor->lock);
+      continue;
+    }
+
+    int first = m->next_row;
+    size_t budget = 0;
+    while (m->next_row < m->rows && budget < MINIMAP_BATCH_LINES)
+      budget += render_row(m, m->next_row++);
+    mark_dirty(m, first, m->next_row - 1);
+
+    // Let the UI thread edit and upload the rows built so far
+    editor_unlock(m->editor);
+    SDL_Delay(1);
+    editor_lock(m->editor);
+  }
+  editor_unlock(m->editor);
+
+  return 0;
+}
+
+static void rebuild_from(minimap_t *m, int row) {
+  if (m->next_row > row)
+    m->next_row = row;
+  SDL_CondSignal(m->wake);
+}
+
+// Keep the cached runs on their lines across an edit that replaced the old
+// lines [first, old_end) with [first, last]. Past a large edit the cache is
+// cut back and the builder measures the lines again.
+static void update_runs(minimap_t *m, size_t first, size_t last,
+                        size_t old_end) {
+  if (m->runs_valid <= first)
+    return;
+  if (m->runs_valid < old_end || last - first >= MINIMAP_BATCH_LINES ||
+      m->run_capacity < m->editor->lines.count) {
+    m->runs_valid = first;
+    return;
+  }
+
+  size_t tail = m->runs_valid - old_end;
+  if (last + 1 != old_end)
+    memmove(m->runs + last + 1, m->runs + old_end,
+            tail * sizeof(minimap_run_t));
+  for (size_t line = first; line <= last; line++)
+    m->runs[line] = measure_line(m->editor, line, NULL);
+  m->runs_valid = last + 1 + tail;
+}
+
+// Called with the editor lock held, right after each edit.
+static void minimap_on_change(void *ctx, const editor_change_t *change) {
+  minimap_t *m = ctx;
+  editor_t *e = m->editor;
+
+  size_t first_line = change->first_line;
+  size_t last_line =
+      line_index_line_of(&e->lines, change->pos + change->inserted);
+
+  int old_px = m->px_per_line;
+  size_t old_lpr = m->lines_per_row;
+  int old_rows = m->rows;
+  bool built = m->next_row >= old_rows;
+  minimap_relayout(m);
+  update_runs(m, first_line, last_line,
+              last_line + 1 - change->line_delta);
+
+  bool same_layout =
+      m->px_per_line == old_px && m->lines_per_row == old_lpr;
+  if (!same_layout) {
+    rebuild_from(m, 0);
+    return;
+  }
+
+  // Still building: the builder will reach the edited rows on its own
+  if (!built) {
+    rebuild_from(m, line_row(m, first_line));
+    return;
+  }
+  m->next_row = m->rows;
+
+  if (change->line_delta != 0) {
+    if (m->lines_per_row > 1) {
+      // Rows blend several lines, so a shift changes every row below. They
+      // are recombined from the cached runs, in the background if there
+      // are many or the cache does not reach the end.
+      int first = line_row(m, first_line);
+      if (m->runs_valid < m->line_count ||
+          m->line_count - first_line > MINIMAP_RECOMBINE_LINES) {
+        rebuild_from(m, first);
+        return;
+      }
+      for (int row = first; row < m->rows; row++)
+        render_row(m, row);
+      mark_dirty(m, first, m->rows - 1);
+      return;
+    }
+
+    // One line per row: slide the cached rows below the edit
+    size_t old_next = last_line + 1 - change->line_delta;
+    int src = line_row(m, old_next);
+    int dst = line_row(m, last_line + 1);
+    if (src < old_rows)
+      memmove(m->pixels + (size_t)dst * MINIMAP_WIDTH,
+              m->pixels + (size_t)src * MINIMAP_WIDTH,
+              (size_t)(old_rows - src) * MINIMAP_WIDTH * sizeof(uint32_t));
+    mark_dirty(m, dst, m->rows - 1);
+  }
+
+  int first = line_row(m, first_line);
+  int last = line_row(m, last_line) + m->px_per_line - 1;
+  if (last >= m->rows)
+    last = m->rows - 1;
+
+  if ((size_t)(last - first) * m->lines_per_row > MINIMAP_BATCH_LINES) {
+    rebuild_from(m, first);
+    return;
+  }
+
+  for (int row = first; row <= last; row++)
+    render_row(m, row);
+  mark_dirty(m, first, last);
+}
+
+minimap_t *minimap_create(SDL_Renderer *renderer, editor_t *editor) {
+  minimap_t *m = calloc(1, sizeof(minimap_t));
+  if (!m)
+    return NULL;
+
+  m->editor = editor;
+  m->pixels = malloc((size_t)MINIMAP_WIDTH * MINIMAP_MAX_ROWS *
+                     sizeof(uint32_t));
+  m->texture =
+      SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                        SDL_TEXTUREACCESS_STREAMING, MINIMAP_WIDTH,
+                        MINIMAP_MAX_ROWS);
+  m->wake = SDL_CreateCond();
+  if (!m->pixels || !m->texture || !m->wake) {
+    SDL_Log("Could not create minimap! %s\n", SDL_GetError());
+    minimap_destroy(m);
+    return NULL;
+  }
+
+  m->dirty_first = MINIMAP_MAX_ROWS;
+  m->dirty_last = -1;
+
+  editor_lock(editor);
+  minimap_relayout(m);
+  m->next_row = 0;
+  editor_add_listener(editor, minimap_on_change, m);
+  editor_unlock(editor);
+
+  m->builder = SDL_CreateThread(minimap_build, "minimap", m);
+  if (!m->builder) {
+    SDL_Log("Could not start minimap builder! %s\n", SDL_GetError());
+    minimap_destroy(m);
+    return NULL;
+  }
+
+  return m;
+}
+
+void minimap_destroy(minimap_t *m) {
+  if (!m)
+    return;
+
+  if (m->builder) {
+    editor_lock(m->editor);
+    m->quit = true;
+    SDL_CondSignal(m->wake);
+    editor_unlock(m->editor);
+    SDL_WaitThread(m->builder, NULL);
+  }
+
+  editor_lock(m->editor);
+  editor_remove_listener(m->editor, minimap_on_change, m);
+  editor_unlock(m->editor);
+
+  if (m->wake)
+    SDL_DestroyCond(m->wake);
+  if (m->texture)
+    SDL_DestroyTexture(m->texture);
+  free(m->pixels);
+  free(m->runs);
+  free(m);
+}
+
+void minimap_render(minimap_t *m, SDL_Renderer *renderer, int x, int height,
+                    int first_line, int visible_lines) {
+  editor_lock(m->editor);
+  if (m->dirty_first <= m->dirty_last) {
+    SDL_Rect dirty = {0, m->dirty_first, MINIMAP_WIDTH,
+                      m->dirty_last - m->dirty_first + 1};
+    SDL_UpdateTexture(m->texture, &dirty,
+                      m->pixels + (size_t)m->dirty_first * MINIMAP_WIDTH,
+                      MINIMAP_WIDTH * sizeof(uint32_t));
+    m->dirty_first = MINIMAP_MAX_ROWS;
+    m->dirty_last = -1;
+  }
+  int rows = m->rows;
+  int view_top = line_row(m, first_line);
+  int view_bottom = line_row(m, first_line + visible_lines);
+  editor_unlock(m->editor);
+
+  SDL_SetRenderDrawColor(renderer, MINIMAP_BG, MINIMAP_BG, MINIMAP_BG, 255);
+  SDL_Rect background = {x, 0, MINIMAP_WIDTH, height};
+  SDL_RenderFillRect(renderer, &background);
+
+  if (rows <= 0)
+    return;
+
+  // Squeeze the document into the window when it has more rows than fit
+  int h = rows < height ? rows : height;
+  SDL_Rect src = {0, 0, MINIMAP_WIDTH, rows};
+  SDL_Rect dst = {x, 0, MINIMAP_WIDTH, h};
+  SDL_RenderCopy(renderer, m->texture, &src, &dst);
+
+  // Highlight the visible part of the document
+  int top = (long)view_top * h / rows;
+  int bottom = (long)view_bottom * h / rows;
+  if (bottom - top < 2)
+    bottom = top + 2;
+  SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+  SDL_SetRenderDrawColor(renderer, 255, 255, 255, 40);
+  SDL_Rect view = {x, top, MINIMAP_WIDTH, bottom - top};
+  SDL_RenderFillRect(renderer, &view);
+  SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+}
+
+// Line shown at window row `y`, a direct computation from the layout.
+int minimap_line_at(minimap_t *m, int y, int height) {
+  editor_lock(m->editor);
+  int rows = m->rows;
+  int h = rows < height ? rows : height;
+  int line = 0;
+
+  if (h > 0) {
+    if (y < 0)
+      y = 0;
+    if (y >= h)
+      y = h - 1;
+    line = row_first_line(m, (long)y * rows / h);
+    if ((size_t)line >= m->line_count)
+      line = m->line_count - 1;
+  }
+  editor_unlock(m->editor);
+
+  return line;
+}
@@ -0,0 +1,120 @@
+#include "../include/utf8.h"
+
+// Decode the code point at `s`. Malformed or truncated input decodes as
+// U+FFFD and consumes one byte, so every byte ends up in some character.
+size_t utf8_decode(const char *s, size_t n, uint32_t *cp) {
+  const unsigned char *u = (const unsigned char *)s;
+  size_t len;
+  uint32_t min;
+
+  if (n == 0) {
+    *cp = 0;
+    return 0;
+  }
+
+  if (u[0] < 0x80) {
+    *cp = u[0];
+    return 1;
+  } else if ((u[0] & 0xE0) == 0xC0) {
+    len = 2;
+    min = 0x80;
+    *cp = u[0] & 0x1F;
+  } else if ((u[0] & 0xF0) == 0xE0) {
+    len = 3;
+    min = 0x800;
+    *cp = u[0] & 0x0F;
+  } else if ((u[0] & 0xF8) == 0xF0) {
+    len = 4;
+    min = 0x10000;
+    *cp = u[0] & 0x07;
+  } else {
+    *cp = 0xFFFD;
+    return 1;
+  }
+
+  if (len > n) {
+    *cp = 0xFFFD;
+    return 1;
+  }
+  for (size_t i = 1; i < len; i++) {
+    if ((u[i] & 0xC0) != 0x80) {
+      *cp = 0xFFFD;
+      return 1;
+    }
+    *cp = (*cp << 6) | (u[i] & 0x3F);
+  }
+  if (*cp < min || *cp > 0x10FFFF || (*cp >= 0xD800 && *cp <= 0xDFFF)) {
+    *cp = 0xFFFD;
+    return 1;
+  }
+  return len;
+}
+
+// Marks that attach to the previous character instead of taking a column:
+// combining diacritics, variation selectors and the zero-width joiner.
+bool utf8_is_combining(uint32_t cp) {
+  return (cp >= 0x0300 && cp <= 0x036F) || (cp >= 0x1AB0 && cp <= 0x1AFF) ||
+         (cp >= 0x1DC0 && cp <= 0x1DFF) || (cp >= 0x20D0 && cp <= 0x20FF) ||
+         (cp >= 0xFE00 && cp <= 0xFE0F) || (cp >= 0xFE20 && cp <= 0xFE2F) ||
+         cp == 0x200D || (cp >= 0xE0100 && cp <= 0xE01EF);
+}
+
+size_t utf8_count_columns(const char *s, size_t n) {
+  size_t cols = 0;
+  for (size_t i = 0; i < n;) {
+    uint32_t cp;
+    i += utf8_decode(s + i, n - i, &cp);
+    if (!utf8_is_combining(cp))
+      cols++;
+  }
+  return cols;
+}
+
+static size_t decode_at(const gap_buffer_t *g, size_t pos, uint32_t *cp) {
+  char bytes[UTF8_MAX_BYTES];
+  size_t n = gap_copy_range(g, pos, UTF8_MAX_BYTES, bytes);
+  return utf8_decode(bytes, n, cp);
+}
+
+// Start of the code point that ends at `pos`.
+static size_t prev_code_point(const gap_buffer_t *g, size_t pos, uint32_t *cp) {
+  size_t start = pos - 1;
+  while (start > 0 && pos - start < UTF8_MAX_BYTES &&
+         ((unsigned char)gap_char_at(g, start) & 0xC0) == 0x80)
+    start--;
+  if (start + decode_at(g, start, cp) != pos) {
+    start = pos - 1;
+    decode_at(g, start, cp);
+  }
+  return start;
+}
+
+// Position after the character at `pos` and any marks attached to it.
+size_t utf8_next_grapheme(const gap_buffer_t *g, size_t pos) {
+  size_t len = gap_buffer_length(g);
+  uint32_t cp;
+
+  if (pos >= len)
+    return len;
+  pos += decode_at(g, pos, &cp);
+
+  while (pos < len) {
+    size_t n = decode_at(g, pos, &cp);
+    if (!utf8_is_combining(cp))
+      break;
+    pos += n;
+  }
+  return pos;
+}
+
+// Start of the character before `pos`, including the marks attached to it.
+size_t utf8_prev_grapheme(const gap_buffer_t *g, size_t pos) {
+  uint32_t cp;
+
+  while (pos > 0) {
+    pos = prev_code_point(g, pos, &cp);
+    if (!utf8_is_combining(cp))
+      break;
+  }
+  return pos;
+}
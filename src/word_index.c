@@ -0,0 +1,511 @@
+#include "../include/word_index.h"
+#include "SDL_error.h"
+#include "SDL_log.h"
+#include "SDL_timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WORD_INDEX_SCAN_BUFFER 16384
+#define WORD_INDEX_TAIL_MIN 1024  // unsorted words tolerated before a merge
+#define WORD_INDEX_TAIL_MAX 16384 // so lookups never scan a long tail
+
+static bool is_word_char(char c) {
+  unsigned char u = (unsigned char)c;
+  return u >= 0x80 || u == '_' || (u >= '0' && u <= '9') ||
+         (u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z');
+}
+
+static uint32_t word_hash(const char *s, size_t n) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < n; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static int word_compare(const word_index_t *wi, uint32_t a, uint32_t b) {
+  const word_entry_t *ea = &wi->entries[a];
+  const word_entry_t *eb = &wi->entries[b];
+  size_t n = ea->len < eb->len ? ea->len : eb->len;
+  int c = memcmp(wi->arena + ea->offset, wi->arena + eb->offset, n);
+  if (c != 0)
+    return c;
+  return (ea->len > eb->len) - (ea->len < eb->len);
+}
+
+static void fill_slots(const word_index_t *wi, uint32_t *slots, size_t cap) {
+  for (uint32_t id = 0; id < wi->entry_count; id++) {
+    size_t i = wi->entries[id].hash & (cap - 1);
+    while (slots[i])
+      i = (i + 1) & (cap - 1);
+    slots[i] = id + 1;
+  }
+}
+
+static bool grow_slots(word_index_t *wi) {
+  size_t cap = wi->slot_cap ? wi->slot_cap * 2 : 4096;
+  uint32_t *slots = calloc(cap, sizeof(uint32_t));
+  if (!slots)
+    return false;
+
+  fill_slots(wi, slots, cap);
+  free(wi->slots);
+  wi->slots = slots;
+  wi->slot_cap = cap;
+  return true;
+}
+
+// Find a word, adding it with a zero count if it is new. Returns UINT32_MAX
+// when it is missing and `create` is false, or on allocation failure.
+static uint32_t word_lookup(word_index_t *wi, const char *word, size_t len,
+                            bool create) {
+  uint32_t hash = word_hash(word, len);
+
+  if (wi->slot_cap) {
+    size_t i = hash & (wi->slot_cap - 1);
+    while (wi->slots[i]) {
+      word_entry_t *e = &wi->entries[wi->slots[i] - 1];
+      if (e->hash == hash && e->len == len &&
+          memcmp(wi->arena + e->offset, word, len) == 0)
+        return wi->slots[i] - 1;
+      i = (i + 1) & (wi->slot_cap - 1);
+    }
+  }
+  if (!create)
+    return UINT32_MAX;
+
+  // Keep the table at most half full
+  if ((size_t)(wi->entry_count + 1) * 2 > wi->slot_cap && !grow_slots(wi))
+    return UINT32_MAX;
+
+  if (wi->entry_count == wi->entry_cap) {
+    uint32_t cap = wi->entry_cap ? wi->entry_cap * 2 : 1024;
+    word_entry_t *entries = realloc(wi->entries, cap * sizeof(word_entry_t));
+    if (!entries)
+      return UINT32_MAX;
+    wi->entries = entries;
+    uint32_t *sorted = realloc(wi->sorted, cap * sizeof(uint32_t));
+    if (!sorted)
+      return UINT32_MAX;
+    wi->sorted = sorted;
+    wi->entry_cap = cap;
+  }
+
+  if (wi->arena_len + len > wi->arena_cap) {
+    size_t cap = wi->arena_cap ? wi->arena_cap * 2 : 65536;
+    while (cap < wi->arena_len + len)
+      cap *= 2;
+    char *arena = realloc(wi->arena, cap);
+    if (!arena)
+      return UINT32_MAX;
+    wi->arena = arena;
+    wi->arena_cap = cap;
+  }
+
+  uint32_t id = wi->entry_count++;
+  word_entry_t *e = &wi->entries[id];
+  e->offset = wi->arena_len;
+  e->len = len;
+  e->hash = hash;
+  e->count = 0;
+  wi->dead_count++;
+  memcpy(wi->arena + wi->arena_len, word, len);
+  wi->arena_len += len;
+  wi->sorted[id] = id;
+
+  size_t i = hash & (wi->slot_cap - 1);
+  while (wi->slots[i])
+    i = (i + 1) & (wi->slot_cap - 1);
+  wi->slots[i] = id + 1;
+  return id;
+}
+
+static void word_count(word_index_t *wi, const char *word, size_t len,
+                       long delta) {
+  if (len < WORD_INDEX_MIN_LEN || (word[0] >= '0' && word[0] <= '9'))
+    return;
+
+  uint32_t id = word_lookup(wi, word, len, delta > 0);
+  if (id == UINT32_MAX)
+    return;
+  word_entry_t *e = &wi->entries[id];
+  bool was_dead = e->count == 0;
+  if (delta < 0 && e->count < (size_t)-delta)
+    e->count = 0;
+  else
+    e->count += delta;
+  if (was_dead != (e->count == 0))
+    wi->dead_count += was_dead ? -1 : 1;
+}
+
+// Count (delta > 0) or uncount (delta < 0) every word in [from, to). Both
+// ends must be outside a word.
+static void scan(word_index_t *wi, size_t from, size_t to, long delta) {
+  char buf[WORD_INDEX_SCAN_BUFFER];
+  char word[WORD_INDEX_MAX_LEN];
+  size_t len = 0;
+  bool too_long = false;
+
+  for (size_t pos = from; pos < to;) {
+    size_t n = gap_copy_range(wi->editor->buffer, pos,
+                              to - pos < sizeof(buf) ? to - pos : sizeof(buf),
+                              buf);
+    if (n == 0)
+      break;
+
+    for (size_t i = 0; i < n; i++) {
+      if (is_word_char(buf[i])) {
+        if (len < WORD_INDEX_MAX_LEN)
+          word[len++] = buf[i];
+        else
+          too_long = true;
+        continue;
+      }
+      if (len && !too_long)
+        word_count(wi, word, len, delta);
+      len = 0;
+      too_long = false;
+    }
+    pos += n;
+  }
+  if (len && !too_long)
+    word_count(wi, word, len, delta);
+}
+
+static size_t word_start(const gap_buffer_t *g, size_t pos) {
+  while (pos > 0 && is_word_char(gap_char_at(g, pos - 1)))
+    pos--;
+  return pos;
+}
+
+static size_t word_end(const gap_buffer_t *g, size_t pos, size_t len) {
+  while (pos < len && is_word_char(gap_char_at(g, pos)))
+    pos++;
+  return pos;
+}
+
+static void sort_ids(const word_index_t *wi, uint32_t *ids, uint32_t *tmp,
+                     size_t n) {
+  if (n < 2)
+    return;
+  size_t half = n / 2;
+  sort_ids(wi, ids, tmp, half);
+  sort_ids(wi, ids + half, tmp, n - half);
+
+  size_t i = 0, j = half, k = 0;
+  while (i < half && j < n)
+    tmp[k++] = word_compare(wi, ids[j], ids[i]) < 0 ? ids[j++] : ids[i++];
+  while (i < half)
+    tmp[k++] = ids[i++];
+  while (j < n)
+    tmp[k++] = ids[j++];
+  memcpy(ids, tmp, n * sizeof(uint32_t));
+}
+
+// Drop the words whose count fell to zero. Survivors keep their order, so
+// their text only slides down the arena; `map` is scratch for the new ids.
+static void compact(word_index_t *wi, uint32_t *map) {
+  uint32_t live = 0;
+  size_t arena_len = 0;
+  for (uint32_t id = 0; id < wi->entry_count; id++) {
+    word_entry_t e = wi->entries[id];
+    if (!e.count) {
+      map[id] = UINT32_MAX;
+      continue;
+    }
+    memmove(wi->arena + arena_len, wi->arena + e.offset, e.len);
+    e.offset = arena_len;
+    arena_len += e.len;
+    map[id] = live;
+    wi->entries[live++] = e;
+  }
+
+  uint32_t k = 0, sorted_count = 0;
+  for (uint32_t i = 0; i < wi->entry_count; i++) {
+    if (map[wi->sorted[i]] != UINT32_MAX)
+      wi->sorted[k++] = map[wi->sorted[i]];
+    if (i + 1 == wi->sorted_count)
+      sorted_count = k;
+  }
+  wi->sorted_count = sorted_count;
+
+  wi->arena_len = arena_len;
+  wi->entry_count = live;
+  wi->dead_count = 0;
+  memset(wi->slots, 0, wi->slot_cap * sizeof(uint32_t));
+  fill_slots(wi, wi->slots, wi->slot_cap);
+}
+
+// Sort the unsorted tail and merge it into the sorted table, dropping dead
+// words on the way. The tail may grow to an eighth of the table, which keeps
+// merging amortized, but never past WORD_INDEX_TAIL_MAX.
+static void merge_tail(word_index_t *wi, bool force) {
+  uint32_t tail = wi->entry_count - wi->sorted_count;
+  uint32_t limit = wi->sorted_count / 8;
+  if (limit < WORD_INDEX_TAIL_MIN)
+    limit = WORD_INDEX_TAIL_MIN;
+  if (limit > WORD_INDEX_TAIL_MAX)
+    limit = WORD_INDEX_TAIL_MAX;
+  if (tail == 0 || (!force && tail < limit))
+    return;
+
+  uint32_t *tmp = malloc(wi->entry_count * sizeof(uint32_t));
+  if (!tmp)
+    return;
+
+  if (wi->dead_count) {
+    compact(wi, tmp);
+    tail = wi->entry_count - wi->sorted_count;
+  }
+
+  uint32_t *ids = wi->sorted + wi->sorted_count;
+  sort_ids(wi, ids, tmp, tail);
+
+  uint32_t i = 0, j = wi->sorted_count, k = 0;
+  while (i < wi->sorted_count && j < wi->entry_count)
+    tmp[k++] = word_compare(wi, wi->sorted[j], wi->sorted[i]) < 0
+                   ? wi->sorted[j++]
+                   : wi->sorted[i++];
+  while (i < wi->sorted_count)
+    tmp[k++] = wi->sorted[i++];
+  while (j < wi->entry_count)
+    tmp[k++] = wi->sorted[j++];
+
+  free(wi->sorted);
+  wi->sorted = tmp;
+  wi->sorted_count = wi->entry_count;
+
+  // The merge buffer only has room for the current words
+  uint32_t *sorted = realloc(wi->sorted, wi->entry_cap * sizeof(uint32_t));
+  if (sorted)
+    wi->sorted = sorted;
+  else
+    wi->entry_cap = wi->entry_count;
+}
+
+static void word_index_clear(word_index_t *wi) {
+  wi->arena_len = 0;
+  wi->entry_count = 0;
+  wi->dead_count = 0;
+  wi->sorted_count = 0;
+  if (wi->slots)
+    memset(wi->slots, 0, wi->slot_cap * sizeof(uint32_t));
+}
+
+static int word_index_build(void *data) {
+  word_index_t *wi = data;
+
+  editor_lock(wi->editor);
+  while (!wi->quit) {
+    if (wi->done) {
+      SDL_CondWait(wi->wake, wi->editor->lock);
+      continue;
+    }
+
+    size_t len = wi->editor->lines.length;
+    size_t end = wi->next_pos + WORD_INDEX_CHUNK;
+    end = end >= len ? len : word_end(wi->editor->buffer, end, len);
+
+    scan(wi, wi->next_pos, end, 1);
+    wi->next_pos = end;
+    wi->done = end >= len;
+    merge_tail(wi, wi->done);
+
+    // Let the UI thread edit between chunks
+    editor_unlock(wi->editor);
+    SDL_Delay(1);
+    editor_lock(wi->editor);
+  }
+  editor_unlock(wi->editor);
+
+  return 0;
+}
+
+// Before an edit: uncount the words it is about to change. Words past the
+// builder are left alone since it has not counted them yet.
+static void word_index_before(void *ctx, const editor_change_t *change) {
+  word_index_t *wi = ctx;
+  const gap_buffer_t *g = wi->editor->buffer;
+  size_t len = wi->editor->lines.length;
+
+  // Loading a file replaces everything; start over in the background
+  wi->edit_reset = change->pos == 0 && change->removed == len;
+  if (wi->edit_reset)
+    return;
+
+  size_t a = word_start(g, change->pos);
+  size_t b = word_end(g, change->pos + change->removed, len);
+  wi->edit_start = a;
+  wi->edit_counted = wi->done || b <= wi->next_pos;
+  if (wi->edit_counted)
+    scan(wi, a, b, -1);
+  else if (a < wi->next_pos)
+    scan(wi, a, wi->next_pos, -1); // the builder rescans from a
+}
+
+// After an edit: count the words now covering the edited range.
+static void word_index_after(void *ctx, const editor_change_t *change) {
+  word_index_t *wi = ctx;
+
+  if (wi->edit_reset) {
+    word_index_clear(wi);
+    wi->next_pos = 0;
+    wi->done = false;
+    SDL_CondSignal(wi->wake);
+    return;
+  }
+
+  if (wi->edit_counted) {
+    size_t b = word_end(wi->editor->buffer, change->pos + change->inserted,
+                        wi->editor->lines.length);
+    scan(wi, wi->edit_start, b, 1);
+    if (!wi->done)
+      wi->next_pos = wi->next_pos - change->removed + change->inserted;
+    merge_tail(wi, false);
+  } else if (wi->edit_start < wi->next_pos) {
+    wi->next_pos = wi->edit_start;
+  }
+}
+
+word_index_t *word_index_create(editor_t *editor) {
+  word_index_t *wi = calloc(1, sizeof(word_index_t));
+  if (!wi)
+    return NULL;
+
+  wi->editor = editor;
+  wi->wake = SDL_CreateCond();
+  if (!wi->wake) {
+    SDL_Log("Could not create word index! %s\n", SDL_GetError());
+    free(wi);
+    return NULL;
+  }
+
+  editor_lock(editor);
+  editor_add_before_listener(editor, word_index_before, wi);
+  editor_add_listener(editor, word_index_after, wi);
+  editor_unlock(editor);
+
+  wi->builder = SDL_CreateThread(word_index_build, "word index", wi);
+  if (!wi->builder) {
+    SDL_Log("Could not start word index builder! %s\n", SDL_GetError());
+    word_index_destroy(wi);
+    return NULL;
+  }
+
+  return wi;
+}
+
+void word_index_destroy(word_index_t *wi) {
+  if (!wi)
+    return;
+
+  if (wi->builder) {
+    editor_lock(wi->editor);
+    wi->quit = true;
+    SDL_CondSignal(wi->wake);
+    editor_unlock(wi->editor);
+    SDL_WaitThread(wi->builder, NULL);
+  }
+
+  editor_lock(wi->editor);
+  editor_remove_listener(wi->editor, word_index_before, wi);
+  editor_remove_listener(wi->editor, word_index_after, wi);
+  editor_unlock(wi->editor);
+
+  SDL_DestroyCond(wi->wake);
+  free(wi->arena);
+  free(wi->entries);
+  free(wi->slots);
+  free(wi->sorted);
+  free(wi);
+}
+
+static bool has_prefix(const word_index_t *wi, uint32_t id, const char *prefix,
+                       size_t n) {
+  const word_entry_t *e = &wi->entries[id];
+  return e->len >= n && memcmp(wi->arena + e->offset, prefix, n) == 0;
+}
+
+// Keep `out` ordered by count, then alphabetically
+static size_t offer(const word_index_t *wi, uint32_t id, word_match_t *out,
+                    size_t found, size_t max) {
+  const word_entry_t *e = &wi->entries[id];
+  const char *word = wi->arena + e->offset;
+
+  size_t at = found;
+  while (at > 0) {
+    const word_match_t *m = &out[at - 1];
+    if (m->count > e->count)
+      break;
+    if (m->count == e->count) {
+      size_t n = m->len < e->len ? m->len : e->len;
+      int c = memcmp(m->word, word, n);
+      if (c < 0 || (c == 0 && m->len < e->len))
+        break;
+    }
+    at--;
+  }
+  if (at >= max)
+    return found;
+
+  if (found == max)
+    found--;
+  memmove(out + at + 1, out + at, (found - at) * sizeof(word_match_t));
+  out[at].word = word;
+  out[at].len = e->len;
+  out[at].count = e->count;
+  return found + 1;
+}
+
+// Most frequent words that start with `prefix` and are longer than it.
+// Call with the editor lock held.
+size_t word_index_complete(word_index_t *wi, const char *prefix, size_t n,
+                           word_match_t *out, size_t max) {
+  if (max > WORD_INDEX_MAX_RESULTS)
+    max = WORD_INDEX_MAX_RESULTS;
+  size_t found = 0;
+
+  // First sorted word not below the prefix
+  size_t lo = 0, hi = wi->sorted_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    const word_entry_t *e = &wi->entries[wi->sorted[mid]];
+    size_t m = e->len < n ? e->len : n;
+    int c = memcmp(wi->arena + e->offset, prefix, m);
+    if (c < 0 || (c == 0 && e->len < n))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  for (size_t i = lo; i < wi->sorted_count; i++) {
+    uint32_t id = wi->sorted[i];
+    if (!has_prefix(wi, id, prefix, n))
+      break;
+    if (wi->entries[id].count && wi->entries[id].len > n)
+      found = offer(wi, id, out, found, max);
+  }
+  for (uint32_t id = wi->sorted_count; id < wi->entry_count; id++) {
+    uint32_t sid = wi->sorted[id];
+    if (wi->entries[sid].count && wi->entries[sid].len > n &&
+        has_prefix(wi, sid, prefix, n))
+      found = offer(wi, sid, out, found, max);
+  }
+
+  return found;
+}
+
+// The part of a word typed before `pos`, copied to `out` (room for
+// WORD_INDEX_MAX_LEN bytes). Returns 0 when pos is inside a word.
+size_t word_index_prefix_at(const editor_t *editor, size_t pos, char *out) {
+  const gap_buffer_t *g = editor->buffer;
+  if (pos < editor->lines.length && is_word_char(gap_char_at(g, pos)))
+    return 0;
+
+  size_t start = word_start(g, pos);
+  if (pos - start > WORD_INDEX_MAX_LEN)
+    return 0;
+  return gap_copy_range(g, start, pos - start, out);
+}
@@ -0,0 +1,90 @@
+// The checks must run in every build
+#undef NDEBUG
+
+#include "../include/line_diff.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static editor_t *editor_with(const char *text) {
+  editor_t *e = editor_create(16);
+  assert(e);
+  bool ok = editor_insert_text(e, text, strlen(text));
+  assert(ok);
+  return e;
+}
+
+static size_t line_start(editor_t *e, size_t line) {
+  return line_index_line_start(&e->lines, line);
+}
+
+// Three saved lines become one: the survivor is modified and the line after
+// the hunk shows the other two are gone.
+static void test_hunk_with_extra_deletions(void) {
+  editor_t *e = editor_with("a\nb\nc\nd\ne\n");
+  line_diff_t *d = line_diff_create(e);
+  assert(d);
+
+  size_t pos = line_start(e, 1);
+  bool ok = editor_replace_range(e, pos, line_start(e, 4) - pos, "X\n", 2);
+  assert(ok);
+  assert(line_diff_mark(d, 0) == 0);
+  assert(line_diff_mark(d, 1) == LINE_DIFF_MODIFIED);
+  assert(line_diff_mark(d, 2) == LINE_DIFF_DELETED_ABOVE);
+  assert(!d->tail_deleted);
+
+  line_diff_destroy(d);
+  editor_destory(e);
+}
+
+// The same at the end of the buffer flags the tail instead.
+static void test_hunk_with_extra_deletions_at_end(void) {
+  editor_t *e = editor_with("a\nb\nc");
+  line_diff_t *d = line_diff_create(e);
+  assert(d);
+
+  size_t pos = line_start(e, 1);
+  bool ok = editor_replace_range(e, pos, e->lines.length - pos, "X", 1);
+  assert(ok);
+  assert(line_diff_mark(d, 1) == LINE_DIFF_MODIFIED);
+  assert(d->tail_deleted);
+
+  line_diff_destroy(d);
+  editor_destory(e);
+}
+
+// Lines appended from disk to a clean buffer join the saved version, so a
+// later edit to one of them is a modification.
+static void test_clean_append_extends_base(void) {
+  editor_t *e = editor_with("a\nb\n");
+  line_diff_t *d = line_diff_create(e);
+  assert(d);
+
+  e->dirty = false;
+  e->syncing = true;
+  bool ok = editor_append(e, "c\nd\n", 4);
+  assert(ok);
+  ok = editor_append(e, "e\n", 2);
+  assert(ok);
+  e->syncing = false;
+  assert(!e->dirty);
+  assert(d->base_count == d->live_count);
+  for (size_t line = 0; line < d->live_count; line++)
+    assert(line_diff_mark(d, line) == 0);
+
+  ok = editor_replace_range(e, line_start(e, 3), 1, "D", 1);
+  assert(ok);
+  for (size_t line = 0; line < d->live_count; line++)
+    assert(line_diff_mark(d, line) == (line == 3 ? LINE_DIFF_MODIFIED : 0));
+
+  line_diff_destroy(d);
+  editor_destory(e);
+}
+
+int main(void) {
+  test_hunk_with_extra_deletions();
+  test_hunk_with_extra_deletions_at_end();
+  test_clean_append_extends_base();
+  printf("line_diff: ok\n");
+  return 0;
+}